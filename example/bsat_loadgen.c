@@ -0,0 +1,676 @@
+/*============================================================================*
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # BSAT Load Generator
+ *
+ * Companion to [the benchmark server](./bsat_server.c): opens a large number
+ * of localhost connections, drives them with a configurable idle pattern, and
+ * measures how accurately the server's idle timeouts close them.
+ *
+ * ## Building and Usage
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C example bsat_server bsat_loadgen
+ *
+ * # In one terminal (30s idle timeout):
+ * ./example/bsat_server -t 4 -m http -i 30
+ *
+ * # In another: 1M connections, 90% of them sending a request every 5s and
+ * # the rest going silent, so the server should close them after 30s:
+ * ./example/bsat_loadgen -t 4 -m http -c 1000000 -i 5 -f 0.1 -T 30
+ * ```
+ *
+ * > :information_source: **NOTE**: a million connections needs a million
+ * > file descriptors on _each_ side (see `ulimit -n` and `fs.nr_open`) and,
+ * > since each source address only has ~28k ephemeral ports, several
+ * > source addresses. By default, connections are spread across
+ * > `127.0.0.1`, `127.0.0.2`, ... — one per 25k connections.
+ *
+ * ## Options
+ *
+ *  - `-p PORT`: server port (default: `8080`)
+ *  - `-t THREADS`: number of event loops, one per thread (default: `1`)
+ *  - `-m MODE`: `echo` or `http` — must match the server (default: `echo`)
+ *  - `-c CONNS`: total number of connections (default: `10000`)
+ *  - `-n SOURCES`: number of `127.0.0.x` source addresses to use
+ *  - `-r RATE`: connection attempts per second (default: `20000`)
+ *  - `-i SECS`: for active connections, the interval between requests
+ *    (default: `1`)
+ *  - `-f FRACTION`: fraction of connections which go silent after connecting
+ *    (default: `0`)
+ *  - `-T SECS`: the server's idle timeout, used to report timeout accuracy
+ *  - `-s SECS`: stats reporting interval (default: `5`)
+ *  - `-d SECS`: how long to run (default: until interrupted)
+ *
+ * ## Measurements
+ *
+ * - **RSS** and **CPU per connection** for the load generator itself (the
+ *   server reports its own).
+ * - **Timeout accuracy**: when the server closes a connection, the load
+ *   generator measures how long it had been idle — i.e. since the last byte
+ *   was sent or received. With `-T`, it reports the error relative to the
+ *   configured timeout; a negative minimum means a connection was closed
+ *   _early_.
+ *
+ * Active connections use libbsat too: their request intervals are timeouts in
+ * a jittered queue (see `bsat_toq_set_jitter`), so requests don't march in
+ * lockstep.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <ev.h>
+
+#include "bsat.h"
+
+
+/*----------------------*
+ *      Constants:
+ *----------------------*/
+#define DEFAULT_PORT 8080
+#define CONNS_PER_SOURCE 25000
+#define CONNECT_TICK 0.01
+#define JITTER_LANES 8
+
+static const char ECHO_REQUEST[] = "ping\n";
+static const char HTTP_REQUEST[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "\r\n";
+
+/* Must match the response sent by bsat_server: */
+static const size_t HTTP_RESPONSE_LEN =
+    sizeof("HTTP/1.1 200 OK\r\n"
+           "Content-Length: 2\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n"
+           "ok") - 1;
+
+
+/*----------------------*
+ *        Types:
+ *----------------------*/
+typedef struct loadgen_config {
+    uint16_t   port;
+    int        no_threads;
+    int        http;
+    size_t     no_conns;
+    size_t     no_sources;
+    double     connect_rate;
+    ev_tstamp  interval;
+    double     silent_fraction;
+    ev_tstamp  expected_timeout;
+    ev_tstamp  stats_interval;
+    ev_tstamp  duration;
+} loadgen_config_t;
+
+typedef struct loadgen_loop loadgen_loop_t;
+
+typedef enum conn_state {
+    CONN_IDLE,
+    CONN_CONNECTING,
+    CONN_OPEN,
+} conn_state_t;
+
+typedef struct conn {
+    int             fd;
+    conn_state_t    state;
+    int             silent;
+    ev_io           w_io;
+    bsat_timeout_t  think;
+    ev_tstamp       last_activity;
+    size_t          awaiting;
+    loadgen_loop_t* owner;
+} conn_t;
+
+typedef struct loadgen_stats {
+    size_t     attempted;
+    size_t     connected;
+    size_t     failed;
+    size_t     open;
+    size_t     requests;
+    size_t     responses;
+    size_t     closed;
+    size_t     no_idle_closes;
+    ev_tstamp  idle_sum;
+    ev_tstamp  idle_min;
+    ev_tstamp  idle_max;
+} loadgen_stats_t;
+
+struct loadgen_loop {
+    int                     id;
+    struct ev_loop*         loop;
+    pthread_t               thread;
+    const loadgen_config_t* config;
+    ev_timer                w_connect;
+    ev_timer                w_stats;
+    ev_timer                w_done;
+    ev_async                w_quit;
+    bsat_toq_t              think_toq;
+
+    conn_t*                 conns;
+    size_t                  no_conns;
+    size_t                  next_conn;
+    loadgen_stats_t         stats;
+};
+
+static loadgen_loop_t* loops = NULL;
+static int no_loops = 0;
+
+
+/*----------------------*
+ *     Connections:
+ *----------------------*/
+static void conn_close(conn_t* conn)
+{
+    loadgen_loop_t* ll = conn->owner;
+    bsat_timeout_stop(&ll->think_toq, &conn->think);
+    ev_io_stop(ll->loop, &conn->w_io);
+    close(conn->fd);
+    if( conn->state == CONN_OPEN ) {
+        ll->stats.open--;
+    }
+    conn->fd = -1;
+    conn->state = CONN_IDLE;
+}
+
+
+static void conn_send_request(conn_t* conn)
+{
+    loadgen_loop_t* ll = conn->owner;
+    const char* req = ll->config->http ? HTTP_REQUEST : ECHO_REQUEST;
+    size_t len = ll->config->http ?
+        sizeof(HTTP_REQUEST) - 1 : sizeof(ECHO_REQUEST) - 1;
+
+    /* Requests are tiny, so a short write just means the server is swamped —
+     * count the request as lost and let the server's timeouts deal with it: */
+    ssize_t no_sent = send(conn->fd, req, len, MSG_NOSIGNAL);
+    if( no_sent == (ssize_t)len ) {
+        ll->stats.requests++;
+        conn->awaiting += ll->config->http ? HTTP_RESPONSE_LEN : len;
+        conn->last_activity = ev_time();
+    }
+}
+
+
+static void think_cb(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    conn_t* conn = timeout->data;
+    conn_send_request(conn);
+    bsat_timeout_start(toq, timeout);
+}
+
+
+static void conn_record_close(conn_t* conn)
+{
+    loadgen_stats_t* st = &conn->owner->stats;
+    ev_tstamp idle = ev_time() - conn->last_activity;
+
+    st->closed++;
+    if( conn->awaiting ) {
+        /* Closed with a request in flight — not an idle timeout: */
+        return;
+    }
+
+    if( !st->no_idle_closes || idle < st->idle_min ) {
+        st->idle_min = idle;
+    }
+    if( idle > st->idle_max ) {
+        st->idle_max = idle;
+    }
+    st->idle_sum += idle;
+    st->no_idle_closes++;
+}
+
+
+static void conn_io_cb(struct ev_loop* loop, ev_io* w, int revents)
+{
+    conn_t* conn = w->data;
+    loadgen_loop_t* ll = conn->owner;
+
+    if( conn->state == CONN_CONNECTING ) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if( err ) {
+            ll->stats.failed++;
+            conn_close(conn);
+            return;
+        }
+
+        conn->state = CONN_OPEN;
+        conn->last_activity = ev_time();
+        ll->stats.connected++;
+        ll->stats.open++;
+
+        ev_io_stop(loop, w);
+        ev_io_set(w, conn->fd, EV_READ);
+        ev_io_start(loop, w);
+
+        if( !conn->silent ) {
+            conn_send_request(conn);
+            bsat_timeout_start(&ll->think_toq, &conn->think);
+        }
+        return;
+    }
+
+    char buf[4096];
+    ssize_t no_recv = recv(conn->fd, buf, sizeof(buf), 0);
+    if( no_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+        return;
+    }
+
+    if( no_recv <= 0 ) {
+        conn_record_close(conn);
+        conn_close(conn);
+        return;
+    }
+
+    conn->last_activity = ev_time();
+    size_t received = (size_t)no_recv;
+    if( received >= conn->awaiting ) {
+        ll->stats.responses++;
+        conn->awaiting = 0;
+    } else {
+        conn->awaiting -= received;
+    }
+}
+
+
+static int conn_open(loadgen_loop_t* ll, conn_t* conn, size_t index)
+{
+    const loadgen_config_t* config = ll->config;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if( fd < 0 ) {
+        return -1;
+    }
+
+    /* Spread connections over 127.0.0.1, 127.0.0.2, ...: */
+    struct sockaddr_in src;
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + index % config->no_sources);
+    int one = 1;
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if( bind(fd, (struct sockaddr*)&src, sizeof(src)) ) {
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(config->port);
+    dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if( connect(fd, (struct sockaddr*)&dst, sizeof(dst))
+            && errno != EINPROGRESS ) {
+        close(fd);
+        return -1;
+    }
+
+    conn->fd = fd;
+    conn->state = CONN_CONNECTING;
+    conn->awaiting = 0;
+    ev_io_init(&conn->w_io, conn_io_cb, fd, EV_WRITE);
+    conn->w_io.data = conn;
+    ev_io_start(ll->loop, &conn->w_io);
+    return 0;
+}
+
+
+static void connect_cb(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    loadgen_loop_t* ll = w->data;
+    size_t batch = (size_t)(ll->config->connect_rate * CONNECT_TICK
+            / ll->config->no_threads) + 1;
+
+    while( batch-- && ll->next_conn < ll->no_conns ) {
+        conn_t* conn = &ll->conns[ll->next_conn];
+        size_t index = ll->next_conn * (size_t)no_loops + (size_t)ll->id;
+        ll->next_conn++;
+        ll->stats.attempted++;
+        if( conn_open(ll, conn, index) ) {
+            ll->stats.failed++;
+        }
+    }
+
+    if( ll->next_conn == ll->no_conns ) {
+        ev_timer_stop(loop, w);
+    }
+}
+
+
+/*----------------------*
+ *        Stats:
+ *----------------------*/
+static size_t process_rss_kb(void)
+{
+    size_t pages = 0;
+    size_t resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if( !statm ) {
+        return 0;
+    }
+
+    if( fscanf(statm, "%zu %zu", &pages, &resident) != 2 ) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+
+static void stats_report(void)
+{
+    /* NOTE: other loops' counters are read without locking; they're only
+     * used for reporting, so a slightly stale total is fine. */
+    loadgen_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for( int i=0; i<no_loops; i++ ) {
+        const loadgen_stats_t* st = &loops[i].stats;
+        total.attempted += st->attempted;
+        total.connected += st->connected;
+        total.failed += st->failed;
+        total.open += st->open;
+        total.requests += st->requests;
+        total.responses += st->responses;
+        total.closed += st->closed;
+        if( st->no_idle_closes ) {
+            if( !total.no_idle_closes || st->idle_min < total.idle_min ) {
+                total.idle_min = st->idle_min;
+            }
+            if( st->idle_max > total.idle_max ) {
+                total.idle_max = st->idle_max;
+            }
+        }
+        total.idle_sum += st->idle_sum;
+        total.no_idle_closes += st->no_idle_closes;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    size_t rss = process_rss_kb();
+
+    printf("attempted=%zu connected=%zu failed=%zu open=%zu "
+            "requests=%zu responses=%zu closed=%zu\n",
+            total.attempted, total.connected, total.failed, total.open,
+            total.requests, total.responses, total.closed);
+    printf("  rss=%zuKB (%0.2fKB/conn) cpu=%0.3fs (%0.2fus/conn)\n",
+            rss, total.open ? (double)rss / total.open : 0.0,
+            cpu, total.connected ? cpu * 1e6 / total.connected : 0.0);
+
+    if( total.no_idle_closes ) {
+        double mean = total.idle_sum / total.no_idle_closes;
+        ev_tstamp expected = loops[0].config->expected_timeout;
+        printf("  idle closes=%zu idle(mean=%0.3fs min=%0.3fs max=%0.3fs)",
+                total.no_idle_closes, mean, total.idle_min, total.idle_max);
+        if( expected > 0.0 ) {
+            printf(" error(mean=%+0.1fms min=%+0.1fms max=%+0.1fms)",
+                    (mean - expected) * 1e3,
+                    (total.idle_min - expected) * 1e3,
+                    (total.idle_max - expected) * 1e3);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+
+static void stats_cb(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    stats_report();
+}
+
+
+/*----------------------*
+ *     Event Loops:
+ *----------------------*/
+static void quit_cb(struct ev_loop* loop, ev_async* w, int revents)
+{
+    ev_break(loop, EVBREAK_ALL);
+}
+
+
+static void quit_all(struct ev_loop* loop)
+{
+    for( int i=1; i<no_loops; i++ ) {
+        ev_async_send(loops[i].loop, &loops[i].w_quit);
+    }
+    ev_break(loop, EVBREAK_ALL);
+}
+
+
+static void done_cb(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    quit_all(loop);
+}
+
+
+static int loadgen_loop_init(
+        loadgen_loop_t* ll, int id, const loadgen_config_t* config)
+{
+    memset(ll, 0, sizeof(*ll));
+    ll->id = id;
+    ll->config = config;
+    ll->loop = id ? ev_loop_new(EVFLAG_AUTO) : ev_default_loop(0);
+    if( !ll->loop ) {
+        return -1;
+    }
+
+    /* Connection i goes to loop i % no_threads: */
+    ll->no_conns = config->no_conns / config->no_threads
+        + ((size_t)id < config->no_conns % config->no_threads);
+    ll->conns = calloc(ll->no_conns ? ll->no_conns : 1, sizeof(conn_t));
+    if( !ll->conns ) {
+        perror("Unable to allocate connections");
+        return -1;
+    }
+
+    bsat_toq_init(ll->loop, &ll->think_toq, think_cb, config->interval);
+    if( config->interval > 0.0 ) {
+        bsat_toq_set_jitter(&ll->think_toq, config->interval / 4, JITTER_LANES);
+    }
+
+    /* Deterministically pick which connections go silent: */
+    double silent_acc = 0.0;
+    for( size_t i=0; i<ll->no_conns; i++ ) {
+        conn_t* conn = &ll->conns[i];
+        conn->fd = -1;
+        conn->owner = ll;
+        bsat_timeout_init(&conn->think);
+        conn->think.data = conn;
+
+        silent_acc += config->silent_fraction;
+        if( silent_acc >= 1.0 ) {
+            silent_acc -= 1.0;
+            conn->silent = 1;
+        }
+    }
+
+    ev_timer_init(&ll->w_connect, connect_cb, 0.0, CONNECT_TICK);
+    ll->w_connect.data = ll;
+    ev_timer_start(ll->loop, &ll->w_connect);
+
+    /* The first loop reports stats and ends the run: */
+    if( id == 0 ) {
+        ev_timer_init(&ll->w_stats, stats_cb,
+                config->stats_interval, config->stats_interval);
+        ll->w_stats.data = ll;
+        ev_timer_start(ll->loop, &ll->w_stats);
+
+        if( config->duration > 0.0 ) {
+            ev_timer_init(&ll->w_done, done_cb, config->duration, 0.0);
+            ev_timer_start(ll->loop, &ll->w_done);
+        }
+    }
+
+    ev_async_init(&ll->w_quit, quit_cb);
+    ev_async_start(ll->loop, &ll->w_quit);
+    return 0;
+}
+
+
+static void* loadgen_loop_run(void* arg)
+{
+    loadgen_loop_t* ll = arg;
+    ev_run(ll->loop, 0);
+    return NULL;
+}
+
+
+static void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents)
+{
+    quit_all(loop);
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-p PORT] [-t THREADS] [-m echo|http] [-c CONNS]\n"
+            "          [-n SOURCES] [-r RATE] [-i INTERVAL] [-f FRACTION]\n"
+            "          [-T TIMEOUT] [-s STATS] [-d DURATION]\n", prog);
+    exit(1);
+}
+
+
+/*----------------------*
+ *        Main:
+ *----------------------*/
+int main(int argc, char** argv)
+{
+    loadgen_config_t config = {
+        .port = DEFAULT_PORT,
+        .no_threads = 1,
+        .http = 0,
+        .no_conns = 10000,
+        .no_sources = 0,
+        .connect_rate = 20000.0,
+        .interval = 1.0,
+        .silent_fraction = 0.0,
+        .expected_timeout = 0.0,
+        .stats_interval = 5.0,
+        .duration = 0.0,
+    };
+
+    int opt;
+    while( (opt = getopt(argc, argv, "p:t:m:c:n:r:i:f:T:s:d:")) != -1 ) {
+        switch( opt ) {
+            case 'p': config.port = (uint16_t)atoi(optarg); break;
+            case 't': config.no_threads = atoi(optarg); break;
+            case 'c': config.no_conns = strtoul(optarg, NULL, 10); break;
+            case 'n': config.no_sources = strtoul(optarg, NULL, 10); break;
+            case 'r': config.connect_rate = strtod(optarg, NULL); break;
+            case 'i': config.interval = strtod(optarg, NULL); break;
+            case 'f': config.silent_fraction = strtod(optarg, NULL); break;
+            case 'T': config.expected_timeout = strtod(optarg, NULL); break;
+            case 's': config.stats_interval = strtod(optarg, NULL); break;
+            case 'd': config.duration = strtod(optarg, NULL); break;
+            case 'm':
+                if( !strcmp(optarg, "http") ) {
+                    config.http = 1;
+                } else if( !strcmp(optarg, "echo") ) {
+                    config.http = 0;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( config.no_threads < 1 || config.interval <= 0.0
+            || config.connect_rate <= 0.0
+            || config.silent_fraction < 0.0 || config.silent_fraction > 1.0 ) {
+        usage(argv[0]);
+    }
+
+    if( !config.no_sources ) {
+        config.no_sources = config.no_conns / CONNS_PER_SOURCE + 1;
+    }
+
+    struct rlimit nofile;
+    if( !getrlimit(RLIMIT_NOFILE, &nofile) ) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+        if( nofile.rlim_cur < config.no_conns + 64 ) {
+            fprintf(stderr, "WARNING: open file limit (%lu) is lower than "
+                    "the number of connections\n",
+                    (unsigned long)nofile.rlim_cur);
+        }
+    }
+
+    printf("BSAT load generator for %s: %zu connection(s) from %zu "
+            "address(es), %d loop(s)\n",
+            BSAT_VERSION_STR, config.no_conns, config.no_sources,
+            config.no_threads);
+
+    loops = calloc(config.no_threads, sizeof(loadgen_loop_t));
+    if( !loops ) {
+        perror("calloc");
+        return 1;
+    }
+
+    no_loops = config.no_threads;
+    for( int i=0; i<no_loops; i++ ) {
+        if( loadgen_loop_init(&loops[i], i, &config) ) {
+            return 1;
+        }
+    }
+
+    ev_signal w_sigint;
+    ev_signal_init(&w_sigint, sigint_cb, SIGINT);
+    ev_signal_start(loops[0].loop, &w_sigint);
+    signal(SIGPIPE, SIG_IGN);
+
+    for( int i=1; i<no_loops; i++ ) {
+        pthread_create(&loops[i].thread, NULL, loadgen_loop_run, &loops[i]);
+    }
+    loadgen_loop_run(&loops[0]);
+
+    for( int i=1; i<no_loops; i++ ) {
+        pthread_join(loops[i].thread, NULL);
+    }
+
+    stats_report();
+    return 0;
+}
@@ -0,0 +1,692 @@
+/*============================================================================*
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # BSAT Benchmark Server
+ *
+ * Unlike [the example server](./bsat_example.c), this is meant to be a
+ * realistic load-testing target: a nonblocking, multi-loop echo or
+ * HTTP/1.1 keepalive server which uses libbsat for all of its timeouts.
+ *
+ * It pairs with [the load generator](./bsat_loadgen.c).
+ *
+ * ## Building and Usage
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C example bsat_server bsat_loadgen
+ *
+ * # 4 loops, HTTP keepalive, 30s idle timeout:
+ * ./example/bsat_server -t 4 -m http -i 30
+ * ```
+ *
+ * ## Options
+ *
+ *  - `-p PORT`: TCP port to listen on (default: `8080`)
+ *  - `-t THREADS`: number of event loops, one per thread (default: `1`)
+ *  - `-m MODE`: `echo` or `http` (default: `echo`)
+ *  - `-c MAX`: maximum connections _per loop_ (default: `262144`)
+ *  - `-i SECS`: idle timeout (default: `30`)
+ *  - `-H SECS`: header timeout, `http` mode only (default: `10`)
+ *  - `-d SECS`: drain timeout (default: `10`)
+ *  - `-s SECS`: stats reporting interval (default: `5`)
+ *
+ * ## Design
+ *
+ * - Each loop runs on its own thread with its own `SO_REUSEPORT` listen
+ *   socket, so the kernel spreads connections across loops.
+ * - Connections come out of a per-loop pool, reserved up front — there's
+ *   no `malloc` per accept. Each loop opens its pool (see `bsat_pool_open`)
+ *   from its own thread, so it's backed by transparent huge pages on that
+ *   thread's NUMA node.
+ * - Sockets are nonblocking; unsent output is buffered and flushed when the
+ *   socket becomes writable.
+ * - Each connection has a _single_ `bsat_timeout_t`, which moves between
+ *   three timeout queues as the connection changes state:
+ *   - `idle`: waiting for the next request (or any data, in `echo` mode).
+ *   - `header`: part of an HTTP request has arrived, but not all of it.
+ *   - `drain`: output is pending and the peer isn't reading it.
+ *
+ * Every `-s` seconds, each loop reports its connection count, how many
+ * connections each timeout closed, and how late (on average and at worst)
+ * timeouts were handled. The first loop also reports process RSS and CPU
+ * time per connection.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <ev.h>
+
+#include "bsat.h"
+
+
+/*----------------------*
+ *      Constants:
+ *----------------------*/
+#define DEFAULT_PORT 8080
+#define DEFAULT_MAX_CONNS 262144
+#define LISTEN_BACKLOG 4096
+#define RECV_BUFFER_SIZE 4096
+#define SEND_BUFFER_SIZE 4096
+
+static const char HTTP_RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 2\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "ok";
+
+
+/*----------------------*
+ *        Types:
+ *----------------------*/
+typedef enum server_mode {
+    MODE_ECHO,
+    MODE_HTTP,
+} server_mode_t;
+
+typedef struct server_config {
+    uint16_t       port;
+    int            no_threads;
+    server_mode_t  mode;
+    size_t         max_conns;
+    ev_tstamp      idle_timeout;
+    ev_tstamp      header_timeout;
+    ev_tstamp      drain_timeout;
+    ev_tstamp      stats_interval;
+} server_config_t;
+
+typedef struct server_loop server_loop_t;
+
+typedef struct conn {
+    int             fd;
+    ev_io           w_io;
+    bsat_timeout_t  timeout;
+    bsat_toq_t*     toq;        /* Queue the timeout is in (if any) */
+    ev_tstamp       touched;    /* When the timeout was last (re)started */
+    server_loop_t*  owner;
+    struct conn*    next_free;
+
+    /* HTTP header terminator matching state: */
+    unsigned int    crlf_state;
+    int             mid_request;
+
+    /* Pending output: */
+    size_t          out_off;
+    size_t          out_len;
+    char            out_buf[SEND_BUFFER_SIZE];
+} conn_t;
+
+typedef struct server_stats {
+    size_t     accepted;
+    size_t     requests;
+    size_t     closed_peer;
+    size_t     closed_idle;
+    size_t     closed_header;
+    size_t     closed_drain;
+    size_t     no_late;
+    ev_tstamp  lateness_sum;
+    ev_tstamp  lateness_max;
+} server_stats_t;
+
+struct server_loop {
+    int                    id;
+    struct ev_loop*        loop;
+    pthread_t              thread;
+    const server_config_t* config;
+    int                    listen_fd;
+    ev_io                  w_accept;
+    ev_timer               w_stats;
+    ev_async               w_quit;
+
+    bsat_toq_t             idle_toq;
+    bsat_toq_t             header_toq;
+    bsat_toq_t             drain_toq;
+
+    bsat_pool_t            pool;
+    conn_t*                free_list;
+    size_t                 no_conns;
+    server_stats_t         stats;
+};
+
+
+static void accept_cb(struct ev_loop* loop, ev_io* w, int revents);
+static void conn_io_cb(struct ev_loop* loop, ev_io* w, int revents);
+static void conn_close(conn_t* conn);
+
+static server_loop_t* loops = NULL;
+static int no_loops = 0;
+
+
+/*----------------------*
+ *      Timeouts:
+ *----------------------*/
+
+/* Move the connection's single timeout into the given queue: */
+static void conn_set_timeout(conn_t* conn, bsat_toq_t* toq)
+{
+    if( conn->toq != toq ) {
+        if( conn->toq ) {
+            bsat_timeout_stop(conn->toq, &conn->timeout);
+        }
+        conn->toq = toq;
+        bsat_timeout_start(toq, &conn->timeout);
+    } else {
+        bsat_timeout_reset(toq, &conn->timeout);
+    }
+    conn->touched = ev_now(conn->owner->loop);
+}
+
+
+static void timeout_cb(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    server_loop_t* sl = toq->data;
+    conn_t* conn = timeout->data;
+
+    ev_tstamp late = ev_now(sl->loop) - (conn->touched + toq->after);
+    if( late < 0.0 ) {
+        late = 0.0;
+    }
+    sl->stats.no_late++;
+    sl->stats.lateness_sum += late;
+    if( late > sl->stats.lateness_max ) {
+        sl->stats.lateness_max = late;
+    }
+
+    if( toq == &sl->idle_toq ) {
+        sl->stats.closed_idle++;
+    } else if( toq == &sl->header_toq ) {
+        sl->stats.closed_header++;
+    } else {
+        sl->stats.closed_drain++;
+    }
+
+    conn->toq = NULL;
+    conn_close(conn);
+}
+
+
+/*----------------------*
+ *     Connections:
+ *----------------------*/
+static conn_t* conn_alloc(server_loop_t* sl)
+{
+    conn_t* conn = sl->free_list;
+    if( conn ) {
+        sl->free_list = conn->next_free;
+    } else if( (conn = bsat_pool_alloc(&sl->pool)) ) {
+        /* Pool entries are only touched once they're needed, so an idle
+         * server doesn't pay for its maximum connection count: */
+        conn->owner = sl;
+        bsat_timeout_init(&conn->timeout);
+        conn->timeout.data = conn;
+    } else {
+        return NULL;
+    }
+
+    sl->no_conns++;
+    return conn;
+}
+
+
+static void conn_close(conn_t* conn)
+{
+    server_loop_t* sl = conn->owner;
+    if( conn->toq ) {
+        bsat_timeout_stop(conn->toq, &conn->timeout);
+        conn->toq = NULL;
+    }
+
+    ev_io_stop(sl->loop, &conn->w_io);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->next_free = sl->free_list;
+    sl->free_list = conn;
+    sl->no_conns--;
+}
+
+
+/* Try to flush pending output; returns -1 if the connection was closed: */
+static int conn_flush(conn_t* conn)
+{
+    server_loop_t* sl = conn->owner;
+    while( conn->out_off < conn->out_len ) {
+        ssize_t no_sent = send(conn->fd,
+                conn->out_buf + conn->out_off,
+                conn->out_len - conn->out_off,
+                MSG_NOSIGNAL);
+        if( no_sent < 0 ) {
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            }
+            sl->stats.closed_peer++;
+            conn_close(conn);
+            return -1;
+        }
+        conn->out_off += (size_t)no_sent;
+    }
+
+    int events;
+    if( conn->out_off < conn->out_len ) {
+        /* The peer isn't keeping up — give it the drain period to catch up: */
+        conn_set_timeout(conn, &sl->drain_toq);
+        events = EV_READ | EV_WRITE;
+    } else {
+        conn->out_off = conn->out_len = 0;
+        conn_set_timeout(conn,
+                conn->mid_request ? &sl->header_toq : &sl->idle_toq);
+        events = EV_READ;
+    }
+
+    if( (conn->w_io.events & (EV_READ | EV_WRITE)) != events ) {
+        ev_io_stop(sl->loop, &conn->w_io);
+        ev_io_set(&conn->w_io, conn->fd, events);
+        ev_io_start(sl->loop, &conn->w_io);
+    }
+    return 0;
+}
+
+
+static void conn_queue_output(conn_t* conn, const char* data, size_t len)
+{
+    /* Compact, then append whatever fits: */
+    if( conn->out_off ) {
+        memmove(conn->out_buf, conn->out_buf + conn->out_off,
+                conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+
+    size_t room = SEND_BUFFER_SIZE - conn->out_len;
+    if( len > room ) {
+        len = room;
+    }
+    memcpy(conn->out_buf + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+
+/* Scan for the end of HTTP request headers, one request at a time: */
+static void conn_handle_http(conn_t* conn, const char* buf, size_t len)
+{
+    static const char terminator[] = "\r\n\r\n";
+    for( size_t i=0; i<len; i++ ) {
+        conn->mid_request = 1;
+        if( buf[i] == terminator[conn->crlf_state] ) {
+            conn->crlf_state++;
+        } else {
+            conn->crlf_state = (buf[i] == '\r') ? 1 : 0;
+        }
+
+        if( conn->crlf_state == 4 ) {
+            conn->crlf_state = 0;
+            conn->mid_request = 0;
+            conn->owner->stats.requests++;
+            conn_queue_output(conn, HTTP_RESPONSE, sizeof(HTTP_RESPONSE)-1);
+        }
+    }
+}
+
+
+static void conn_io_cb(struct ev_loop* loop, ev_io* w, int revents)
+{
+    conn_t* conn = w->data;
+    server_loop_t* sl = conn->owner;
+    char buf[RECV_BUFFER_SIZE];
+
+    if( revents & EV_WRITE ) {
+        if( conn_flush(conn) ) {
+            return;
+        }
+    }
+
+    if( !(revents & EV_READ) ) {
+        return;
+    }
+
+    /* Don't read more than we can buffer a response for: */
+    size_t room = SEND_BUFFER_SIZE - (conn->out_len - conn->out_off);
+    if( room < sizeof(HTTP_RESPONSE) ) {
+        return;
+    }
+    if( room > RECV_BUFFER_SIZE ) {
+        room = RECV_BUFFER_SIZE;
+    }
+
+    ssize_t no_recv = recv(conn->fd, buf, room, 0);
+    if( no_recv <= 0 ) {
+        if( no_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+            return;
+        }
+        sl->stats.closed_peer++;
+        conn_close(conn);
+        return;
+    }
+
+    if( sl->config->mode == MODE_HTTP ) {
+        conn_handle_http(conn, buf, (size_t)no_recv);
+    } else {
+        sl->stats.requests++;
+        conn_queue_output(conn, buf, (size_t)no_recv);
+    }
+
+    /* Flushing also moves the timeout to the right queue: */
+    conn_flush(conn);
+}
+
+
+static void accept_cb(struct ev_loop* loop, ev_io* w, int revents)
+{
+    server_loop_t* sl = w->data;
+
+    for( ;; ) {
+        int fd = accept(sl->listen_fd, NULL, NULL);
+        if( fd < 0 ) {
+            if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+                perror("accept");
+            }
+            return;
+        }
+
+        conn_t* conn = conn_alloc(sl);
+        if( !conn ) {
+            /* At capacity: */
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn->fd = fd;
+        conn->toq = NULL;
+        conn->crlf_state = 0;
+        conn->mid_request = 0;
+        conn->out_off = conn->out_len = 0;
+        sl->stats.accepted++;
+
+        ev_io_init(&conn->w_io, conn_io_cb, fd, EV_READ);
+        conn->w_io.data = conn;
+        ev_io_start(loop, &conn->w_io);
+        conn_set_timeout(conn, &sl->idle_toq);
+    }
+}
+
+
+/*----------------------*
+ *        Stats:
+ *----------------------*/
+static size_t process_rss_kb(void)
+{
+    size_t pages = 0;
+    size_t resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if( !statm ) {
+        return 0;
+    }
+
+    if( fscanf(statm, "%zu %zu", &pages, &resident) != 2 ) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+
+static void stats_cb(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    server_loop_t* sl = w->data;
+    server_stats_t* st = &sl->stats;
+
+    printf("[loop %d] conns=%zu accepted=%zu requests=%zu "
+            "closed(peer=%zu idle=%zu header=%zu drain=%zu) "
+            "lateness(mean=%0.3fms max=%0.3fms)\n",
+            sl->id, sl->no_conns, st->accepted, st->requests,
+            st->closed_peer, st->closed_idle, st->closed_header,
+            st->closed_drain,
+            st->no_late ? st->lateness_sum * 1e3 / st->no_late : 0.0,
+            st->lateness_max * 1e3);
+
+    /* Process-wide numbers come from the first loop: */
+    if( sl->id == 0 ) {
+        size_t total = 0;
+        for( int i=0; i<no_loops; i++ ) {
+            total += loops[i].no_conns;
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+            + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        size_t rss = process_rss_kb();
+
+        printf("[process] conns=%zu rss=%zuKB (%0.2fKB/conn) cpu=%0.3fs\n",
+                total, rss, total ? (double)rss / total : 0.0, cpu);
+    }
+    fflush(stdout);
+}
+
+
+/*----------------------*
+ *     Event Loops:
+ *----------------------*/
+static int bind_and_listen(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if( fd < 0 ) {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if( bind(fd, (struct sockaddr*)&addr, sizeof(addr))
+            || listen(fd, LISTEN_BACKLOG) ) {
+        fprintf(stderr, "Unable to listen on port %u: %s\n",
+                port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static void quit_cb(struct ev_loop* loop, ev_async* w, int revents)
+{
+    ev_break(loop, EVBREAK_ALL);
+}
+
+
+static int server_loop_init(
+        server_loop_t* sl, int id, const server_config_t* config)
+{
+    memset(sl, 0, sizeof(*sl));
+    sl->id = id;
+    sl->config = config;
+    sl->loop = id ? ev_loop_new(EVFLAG_AUTO) : ev_default_loop(0);
+    sl->listen_fd = bind_and_listen(config->port);
+    if( !sl->loop || sl->listen_fd < 0 ) {
+        return -1;
+    }
+
+    bsat_toq_init(sl->loop, &sl->idle_toq, timeout_cb, config->idle_timeout);
+    bsat_toq_init(sl->loop, &sl->header_toq, timeout_cb,
+            config->header_timeout);
+    bsat_toq_init(sl->loop, &sl->drain_toq, timeout_cb, config->drain_timeout);
+    sl->idle_toq.data = sl->header_toq.data = sl->drain_toq.data = sl;
+
+    ev_io_init(&sl->w_accept, accept_cb, sl->listen_fd, EV_READ);
+    sl->w_accept.data = sl;
+    ev_io_start(sl->loop, &sl->w_accept);
+
+    ev_timer_init(&sl->w_stats, stats_cb,
+            config->stats_interval, config->stats_interval);
+    sl->w_stats.data = sl;
+    ev_timer_start(sl->loop, &sl->w_stats);
+
+    ev_async_init(&sl->w_quit, quit_cb);
+    ev_async_start(sl->loop, &sl->w_quit);
+    return 0;
+}
+
+
+static void* server_loop_run(void* arg)
+{
+    server_loop_t* sl = arg;
+
+    /* From the loop's own thread, so the pool is local to it: */
+    if( bsat_pool_open(&sl->pool, sizeof(conn_t), sl->config->max_conns,
+                BSAT_POOL_THP | BSAT_POOL_NUMA_LOCAL) ) {
+        perror("Unable to allocate connection pool");
+        exit(1);
+    }
+
+    ev_run(sl->loop, 0);
+    return NULL;
+}
+
+
+static void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents)
+{
+    for( int i=1; i<no_loops; i++ ) {
+        ev_async_send(loops[i].loop, &loops[i].w_quit);
+    }
+    ev_break(loop, EVBREAK_ALL);
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-p PORT] [-t THREADS] [-m echo|http] [-c MAX]\n"
+            "          [-i IDLE] [-H HEADER] [-d DRAIN] [-s STATS]\n", prog);
+    exit(1);
+}
+
+
+/*----------------------*
+ *        Main:
+ *----------------------*/
+int main(int argc, char** argv)
+{
+    server_config_t config = {
+        .port = DEFAULT_PORT,
+        .no_threads = 1,
+        .mode = MODE_ECHO,
+        .max_conns = DEFAULT_MAX_CONNS,
+        .idle_timeout = 30.0,
+        .header_timeout = 10.0,
+        .drain_timeout = 10.0,
+        .stats_interval = 5.0,
+    };
+
+    int opt;
+    while( (opt = getopt(argc, argv, "p:t:m:c:i:H:d:s:")) != -1 ) {
+        switch( opt ) {
+            case 'p': config.port = (uint16_t)atoi(optarg); break;
+            case 't': config.no_threads = atoi(optarg); break;
+            case 'c': config.max_conns = strtoul(optarg, NULL, 10); break;
+            case 'i': config.idle_timeout = strtod(optarg, NULL); break;
+            case 'H': config.header_timeout = strtod(optarg, NULL); break;
+            case 'd': config.drain_timeout = strtod(optarg, NULL); break;
+            case 's': config.stats_interval = strtod(optarg, NULL); break;
+            case 'm':
+                if( !strcmp(optarg, "http") ) {
+                    config.mode = MODE_HTTP;
+                } else if( !strcmp(optarg, "echo") ) {
+                    config.mode = MODE_ECHO;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( config.no_threads < 1 || !config.max_conns ) {
+        usage(argv[0]);
+    }
+
+    /* Leave room for a lot of file descriptors: */
+    struct rlimit nofile;
+    if( !getrlimit(RLIMIT_NOFILE, &nofile) ) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    printf("BSAT benchmark server for %s: %d loop(s), %s mode, port %u\n",
+            BSAT_VERSION_STR, config.no_threads,
+            config.mode == MODE_HTTP ? "http" : "echo", config.port);
+
+    loops = calloc(config.no_threads, sizeof(server_loop_t));
+    if( !loops ) {
+        perror("calloc");
+        return 1;
+    }
+
+    no_loops = config.no_threads;
+    for( int i=0; i<no_loops; i++ ) {
+        if( server_loop_init(&loops[i], i, &config) ) {
+            return 1;
+        }
+    }
+
+    ev_signal w_sigint;
+    ev_signal_init(&w_sigint, sigint_cb, SIGINT);
+    ev_signal_start(loops[0].loop, &w_sigint);
+    signal(SIGPIPE, SIG_IGN);
+
+    for( int i=1; i<no_loops; i++ ) {
+        pthread_create(&loops[i].thread, NULL, server_loop_run, &loops[i]);
+    }
+    server_loop_run(&loops[0]);
+
+    for( int i=1; i<no_loops; i++ ) {
+        pthread_join(loops[i].thread, NULL);
+    }
+
+    for( int i=0; i<no_loops; i++ ) {
+        stats_cb(loops[i].loop, &loops[i].w_stats, 0);
+    }
+    return 0;
+}
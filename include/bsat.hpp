@@ -0,0 +1,233 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+#ifndef BSAT_HPP
+#define BSAT_HPP
+
+#include <cstddef>
+#include <utility>
+#include "bsat.h"
+
+/** # API Ref: libbsat C++ wrapper
+ *
+ * A header-only C++11 wrapper around `bsat.h`, e.g.:
+ *
+ * ```C++
+ * struct connection {
+ *     bsat::timeout idle;
+ *     void on_idle();
+ * };
+ *
+ * bsat::queue<connection, &connection::idle, &connection::on_idle>
+ *     idle_queue(loop, 30.0);
+ *
+ * idle_queue.start(conn);
+ * ```
+ *
+ * The owner of a timeout is recovered from the member offset (so the
+ * `void* data` members go unused) and the owner's handler is bound at compile
+ * time, so it can be inlined into the callback which the queue invokes.
+ */
+
+namespace bsat {
+
+/** ## Types */
+
+/** ### bsat::timeout
+ *
+ * RAII handle for a `bsat_timeout_t`, meant to be embedded in the structure
+ * that owns it.
+ *
+ * - Destroying an active handle stops it, so a destroyed owner can never leave
+ *   a dangling link in its queue.
+ * - Moving an active handle transfers its queue position (and deadline) to
+ *   the destination (see `bsat_timeout_move`).
+ */
+class timeout {
+public:
+    timeout() noexcept : toq_(nullptr)
+    {
+        bsat_timeout_init(&item_);
+    }
+
+    ~timeout()
+    {
+        stop();
+    }
+
+    timeout(const timeout&) = delete;
+    timeout& operator=(const timeout&) = delete;
+
+    timeout(timeout&& other) noexcept : toq_(nullptr)
+    {
+        bsat_timeout_init(&item_);
+        take(other);
+    }
+
+    timeout& operator=(timeout&& other) noexcept
+    {
+        if( this != &other ) {
+            stop();
+            take(other);
+        }
+        return *this;
+    }
+
+    /** Stop the timeout, if it's active. */
+    void stop() noexcept
+    {
+        if( toq_ ) {
+            bsat_timeout_stop(toq_, &item_);
+            toq_ = nullptr;
+        }
+    }
+
+    /** Returns true if the timeout is active. */
+    bool active() const noexcept
+    {
+        return bsat_timeout_is_active(const_cast<bsat_timeout_t*>(&item_));
+    }
+
+    /** The underlying `bsat_timeout_t`. */
+    bsat_timeout_t* get() noexcept
+    {
+        return &item_;
+    }
+
+private:
+    template<typename Owner, timeout Owner::*Member, void (Owner::*Handler)()>
+    friend class queue;
+
+    void take(timeout& other) noexcept
+    {
+        if( other.toq_ ) {
+            bsat_timeout_move(other.toq_, &item_, &other.item_);
+            toq_ = other.toq_;
+            other.toq_ = nullptr;
+        }
+    }
+
+    static timeout* from_item(bsat_timeout_t* item) noexcept
+    {
+        return reinterpret_cast<timeout*>(
+                reinterpret_cast<char*>(item) - offsetof(timeout, item_));
+    }
+
+    bsat_toq_t*    toq_;
+    bsat_timeout_t item_;
+};
+
+
+/** ### bsat::queue
+ *
+ * A timeout queue for `Owner` objects which embed a `bsat::timeout` as
+ * `Member`. When an owner's timeout fires, `(owner.*Handler)()` is invoked.
+ *
+ * Queues are neither copyable nor movable (libev and the queue's items hold
+ * pointers to it). Destroying a queue stops every timeout in it.
+ */
+template<typename Owner, timeout Owner::*Member, void (Owner::*Handler)()>
+class queue {
+public:
+    queue(struct ev_loop* loop, ev_tstamp after) noexcept
+    {
+        bsat_toq_init(loop, &toq_, &queue::dispatch, after);
+        toq_.data = this;
+    }
+
+    ~queue()
+    {
+        bsat_toq_clear(&toq_);
+        bsat_toq_stop(&toq_);
+    }
+
+    queue(const queue&) = delete;
+    queue& operator=(const queue&) = delete;
+
+    /** Start the owner's timeout (a no-op if it's already started here). */
+    void start(Owner& owner) noexcept
+    {
+        timeout& t = owner.*Member;
+        attach(t);
+        bsat_timeout_start(&toq_, &t.item_);
+    }
+
+    /** Reset the owner's timeout, starting it if it isn't active. */
+    void reset(Owner& owner) noexcept
+    {
+        timeout& t = owner.*Member;
+        attach(t);
+        bsat_timeout_reset(&toq_, &t.item_);
+    }
+
+    /** Stop the owner's timeout. */
+    void stop(Owner& owner) noexcept
+    {
+        (owner.*Member).stop();
+    }
+
+    /** The underlying `bsat_toq_t`, for use with the rest of the C API. */
+    bsat_toq_t* get() noexcept
+    {
+        return &toq_;
+    }
+
+private:
+    void attach(timeout& t) noexcept
+    {
+        if( t.toq_ != &toq_ ) {
+            t.stop();
+            t.toq_ = &toq_;
+        }
+    }
+
+    static Owner* owner_of(bsat_timeout_t* item) noexcept
+    {
+        return reinterpret_cast<Owner*>(
+                reinterpret_cast<char*>(timeout::from_item(item))
+                - member_offset());
+    }
+
+    static std::ptrdiff_t member_offset() noexcept
+    {
+        /* offsetof doesn't work with pointers-to-member; this gets folded to a
+         * constant by the compiler: */
+        alignas(Owner) static char storage[sizeof(Owner)];
+        Owner* owner = reinterpret_cast<Owner*>(storage);
+        return reinterpret_cast<char*>(&(owner->*Member))
+            - reinterpret_cast<char*>(owner);
+    }
+
+    static void dispatch(bsat_toq_t*, bsat_timeout_t* item)
+    {
+        (owner_of(item)->*Handler)();
+    }
+
+    bsat_toq_t toq_;
+};
+
+} /* namespace bsat */
+
+#endif /* BSAT_HPP */
@@ -0,0 +1,166 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+#ifndef BSAT_UV_H
+#define BSAT_UV_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <uv.h>
+#include "bsat.h"
+
+/** # API Ref: libbsat libuv adapter
+ *
+ * A header-only adapter which drives a `bsat_toq_t` from a libuv loop, using
+ * a single `uv_timer_t` per queue and `uv_now()` as its clock (see
+ * `bsat_toq_set_scheduler`), e.g.:
+ *
+ * ```C
+ * bsat_uv_toq_t idle_queue;
+ * bsat_uv_toq_init(uv_default_loop(), &idle_queue, on_idle, 30.0);
+ *
+ * bsat_timeout_start(&idle_queue.toq, &conn->idle);
+ * ```
+ *
+ * Everything else is the same as it is with libev: items are started, reset,
+ * and stopped with the usual functions on `&uvq->toq`, in `O(1)`, and libuv
+ * only ever sees one timer, no matter how many connections there are.
+ *
+ * NOTE: libbsat itself still links against libev (for the types), but no
+ * libev loop is created or run. Since `uv_now()` has millisecond resolution,
+ * so do timeouts in a queue driven by libuv.
+ */
+
+
+/** ## Types */
+
+/** ### bsat_uv_toq_t
+ *
+ * A timeout queue, along with the libuv timer which drives it. `toq` comes
+ * first, so that the adapter can get back here from a `bsat_toq_t*` — its
+ * `data` member is left to you.
+ */
+typedef struct bsat_uv_toq {
+    bsat_toq_t toq;
+    uv_timer_t timer;
+} bsat_uv_toq_t;
+
+
+/*--------------------------------------------------
+ * BSAT libuv Functions:
+ *--------------------------------------------------*/
+/** ## libuv Functions */
+
+/** ### bsat_uv_clock
+ *
+ * Clock for queues driven by libuv: the cached time of the timer's loop, in
+ * seconds.
+ */
+static inline ev_tstamp bsat_uv_clock(bsat_toq_t* toq)
+{
+    bsat_uv_toq_t* uvq = (bsat_uv_toq_t*)toq;
+    return (ev_tstamp)uv_now(uvq->timer.loop) / 1e3;
+}
+
+
+/** ### bsat_uv_timer_cb
+ *
+ * Timer callback for queues driven by libuv: expires whatever is due.
+ */
+static inline void bsat_uv_timer_cb(uv_timer_t* timer)
+{
+    bsat_uv_toq_t* uvq = (bsat_uv_toq_t*)timer->data;
+    bsat_toq_expire_due(&(uvq->toq));
+    return;
+}
+
+
+/** ### bsat_uv_schedule
+ *
+ * Scheduler for queues driven by libuv: (re)starts or stops the timer.
+ */
+static inline void bsat_uv_schedule(bsat_toq_t* toq, ev_tstamp delay)
+{
+    bsat_uv_toq_t* uvq = (bsat_uv_toq_t*)toq;
+    if( delay < 0.0 ) {
+        uv_timer_stop(&(uvq->timer));
+        return;
+    }
+
+    /* Round up, so the timer never goes off before the deadline: */
+    ev_tstamp ms = delay * 1e3;
+    uint64_t timeout = (uint64_t)ms;
+    if( (ev_tstamp)timeout < ms ) {
+        timeout++;
+    }
+    uv_timer_start(&(uvq->timer), bsat_uv_timer_cb, timeout, 0);
+    return;
+}
+
+
+/** ### bsat_uv_toq_init
+ *
+ * Initialize `uvq` to expire items on `loop`, `after` seconds after they're
+ * started or reset, invoking `cb` for each.
+ *
+ * Returns `0` on success; `-1` (with `errno` set) if the timer couldn't be
+ * initialized.
+ */
+static inline int bsat_uv_toq_init(
+        uv_loop_t* loop,
+        bsat_uv_toq_t* uvq,
+        bsat_callback_t cb,
+        ev_tstamp after)
+{
+    int rc = uv_timer_init(loop, &(uvq->timer));
+    if( rc ) {
+        errno = -rc;
+        return -1;
+    }
+    uvq->timer.data = uvq;
+
+#if EV_MULTIPLICITY
+    bsat_toq_init(NULL, &(uvq->toq), cb, after);
+#else
+    bsat_toq_init(&(uvq->toq), cb, after);
+#endif /* EV_MULTIPLICITY */
+    return bsat_toq_set_scheduler(&(uvq->toq), bsat_uv_schedule, bsat_uv_clock);
+}
+
+
+/** ### bsat_uv_toq_close
+ *
+ * Stop every item in `uvq` (without invoking callbacks) and close its timer.
+ * As with any libuv handle, `uvq` mustn't be freed until `close_cb` has been
+ * invoked (which may be `NULL`).
+ */
+static inline void bsat_uv_toq_close(bsat_uv_toq_t* uvq, uv_close_cb close_cb)
+{
+    bsat_toq_clear(&(uvq->toq));
+    uv_close((uv_handle_t*)&(uvq->timer), close_cb);
+    return;
+}
+
+#endif /* BSAT_UV_H */
@@ -24,10 +24,41 @@
  *----------------------------------------------------------------------------*/
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <time.h>
 
 #include "bsat_config.h"
 #include "bsat.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
+#ifdef HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+#endif /* HAVE_LINUX_IO_URING_H */
+
+#ifdef HAVE_LINUX_MEMPOLICY_H
+# include <sys/syscall.h>
+# include <linux/mempolicy.h>
+#endif /* HAVE_LINUX_MEMPOLICY_H */
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define RING_X86 1
+#endif /* x86 */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define RING_NEON 1
+#endif /* NEON */
+
 
 /*--------------------------------------------------
  * Macros and utils:
@@ -40,6 +71,73 @@
 # define TOQ_LOOP_
 #endif /* EV_MULTIPLICITY */
 
+#if EV_MULTIPLICITY
+# define EXECUTOR_LOOP executor->loop
+# define EXECUTOR_LOOP_ executor->loop,
+#else
+# define EXECUTOR_LOOP
+# define EXECUTOR_LOOP_
+#endif /* EV_MULTIPLICITY */
+
+/* The current time, per the queue's clock (see bsat_toq_set_poll_mode): */
+#define TOQ_NOW(toq) \
+    ((toq)->clock ? (toq)->clock(toq) : ev_now(TOQ_LOOP))
+
+/* Record a trace event, if tracing is enabled for the queue: */
+#define BSAT_TRACE(toq, item, type, now) \
+    if( (toq)->trace ) { \
+        bsat_trace_record((toq)->trace, (item), (type), (now)); \
+    }
+
+/* What the lanes of a queue (if any) are used for: */
+#define LANES_NONE   0
+#define LANES_JITTER 1
+#define LANES_STAGES 2
+#define LANES_CLASSES 3
+
+/* Where the io_uring timeout of a queue is at (see bsat_toq_set_uring): */
+#define URING_IDLE      0
+#define URING_ARMED     1
+#define URING_CANCELING 2
+
+/* The heap index of a queue with no deadline posted to its timer service: */
+#define SERVICE_NONE ((size_t)-1)
+
+/* Shared regions: where the lists start, a worker's slots, and how many
+ * times to re-read a list that's being written (see bsat_shm_open): */
+#define SHM_LISTS_OFFSET 64
+#define SHM_SLOTS(shm, worker) \
+    ((shm)->slots + (size_t)(worker) * (shm)->header->no_slots)
+#define SHM_RETRIES 1000
+#define SHM_BUSY ((size_t)-1)
+
+/* Rings: ticks are kept below RING_MAX_TICK (so that they compare the same
+ * signed or unsigned), by moving the epoch up as time goes by: */
+#define RING_MAX_TICK (1u << 30)
+#define RING_INDEX(ring, pos) ((pos) & ((ring)->capacity - 1))
+
+/* Pools: huge pages are taken to be 2MB (the default on x86-64, and on
+ * aarch64 with 4k pages), items are aligned for anything, and NUMA nodes
+ * are numbered below POOL_MAX_NODES: */
+#define POOL_HUGE_PAGE ((size_t)2 << 20)
+#define POOL_ALIGN 16
+#define POOL_MAX_NODES 1024
+
+/* Relaxed accesses to shared list fields (the seqlock orders them): */
+#define SHM_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define SHM_STORE(field, value) \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/* Whether an item is the node of a bsat_timeout_group_t: */
+#define IS_GROUP_NODE(item) \
+    ((item)->group && &(item)->group->node == (item))
+
+/* The time at which the head of a lane expires: */
+#define LANE_DEADLINE(lane) ((lane)->head->tstamp + (lane)->after)
+
+/* The i-th lane of a queue (a queue without lanes is its own lane 0): */
+#define LANE_AT(toq, i) ((toq)->no_lanes ? &(toq)->lanes[i] : (toq))
+
 
 /*--------------------------------------------------
  * Globals:
@@ -51,7 +149,90 @@ const char* BSAT_VERSION_STR = PACKAGE_VERSION;
  * Prototypes:
  *--------------------------------------------------*/
 static void bsat_toq_dispatch(EV_P_ ev_timer* w, int revents);
+static void bsat_toq_check(EV_P_ ev_check* w, int revents);
+static void bsat_toq_check_start(bsat_toq_t* toq);
+static void bsat_toq_check_stop(bsat_toq_t* toq);
 static void bsat_toq_schedule_next(bsat_toq_t* toq);
+static void bsat_toq_uring_arm(bsat_toq_t* toq);
+static void bsat_toq_uring_disarm(bsat_toq_t* toq);
+static void bsat_toq_link(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp now);
+static int bsat_toq_append(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp now);
+static void bsat_toq_unlink(bsat_toq_t* toq, bsat_timeout_t* item);
+static void bsat_toq_rotate(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp tstamp);
+static void bsat_toq_invoke(bsat_toq_t* toq, bsat_timeout_t* item);
+static void bsat_toq_expire_item(bsat_toq_t* toq, bsat_timeout_t* item);
+static void bsat_toq_dispatch_rearm(
+        bsat_toq_t* toq,
+        bsat_toq_t* lane,
+        bsat_timeout_t* item,
+        ev_tstamp now);
+static size_t bsat_toq_expire_group(
+        bsat_toq_t* toq,
+        bsat_timeout_group_t* group,
+        unsigned int generation);
+static void bsat_trace_record(
+        bsat_trace_header_t* trace,
+        bsat_timeout_t* item,
+        bsat_trace_type_t type,
+        ev_tstamp now);
+static size_t bsat_toq_dispatch_limit(bsat_toq_t* toq);
+static void bsat_toq_track_storm(
+        bsat_toq_t* toq, size_t no_expired, ev_tstamp now);
+static bsat_toq_t* bsat_toq_next_lane(bsat_toq_t* toq);
+static bsat_toq_t* bsat_toq_oldest_lane(bsat_toq_t* toq);
+static size_t bsat_toq_evict(bsat_toq_t* toq, ev_tstamp threshold, size_t n);
+static bsat_toq_t* bsat_toq_next_due(bsat_toq_t* toq, ev_tstamp now);
+static void* bsat_service_run(void* arg);
+static void bsat_service_notify(EV_P_ ev_async* w, int revents);
+static void bsat_service_schedule(bsat_toq_t* toq, ev_tstamp delay);
+static ev_tstamp bsat_service_clock(bsat_toq_t* toq);
+static void bsat_service_swap(bsat_service_t* service, size_t i, size_t j);
+static void bsat_service_sift(bsat_service_t* service, size_t idx);
+static void bsat_service_unlink(bsat_service_t* service, bsat_toq_t* toq);
+static void bsat_toq_offload(bsat_toq_t* toq, bsat_timeout_t* item);
+static void bsat_toq_submit(bsat_toq_t* toq);
+static void* bsat_executor_work(void* arg);
+static void bsat_executor_run(bsat_executor_t* executor, bsat_batch_t* batch);
+static void bsat_executor_notify(EV_P_ ev_async* w, int revents);
+static void bsat_executor_complete(bsat_executor_t* executor);
+static bsat_batch_t* bsat_executor_take(bsat_executor_t* executor);
+static void bsat_batch_push(
+        bsat_batch_t** stack, bsat_batch_t* first, bsat_batch_t* last);
+static bsat_ring_scan_t bsat_ring_kernel(const char* isa);
+static size_t bsat_ring_scan_scalar(
+        const uint32_t* ticks, size_t n, uint32_t now);
+static uint32_t bsat_ring_tick(bsat_ring_t* ring, ev_tstamp now);
+static void bsat_ring_compact(bsat_ring_t* ring);
+static int bsat_shm_map(bsat_shm_t* shm, int fd, size_t size);
+static char* bsat_pool_map(size_t size, size_t align);
+static int bsat_pool_bind(char* base, size_t size);
+static void bsat_shm_write_begin(bsat_shm_list_t* list);
+static void bsat_shm_write_end(bsat_shm_list_t* list);
+static void bsat_shm_link(
+        bsat_shm_list_t* list,
+        bsat_shm_slot_t* slots,
+        uint32_t idx,
+        ev_tstamp now);
+static void bsat_shm_unlink(
+        bsat_shm_list_t* list, bsat_shm_slot_t* slots, uint32_t idx);
+static size_t bsat_shm_read_list(
+        const bsat_shm_t* shm,
+        unsigned int worker,
+        ev_tstamp before,
+        bsat_shm_item_t* out,
+        size_t max);
+static void bsat_toq_track_classes(
+        bsat_toq_t* toq, bsat_toq_t* lane, ev_tstamp now);
+static bsat_toq_t* bsat_toq_route(bsat_toq_t* toq, bsat_timeout_t* item);
+static void bsat_toq_free_lanes(bsat_toq_t* toq);
+static int bsat_toq_alloc_lanes(
+        bsat_toq_t* toq,
+        int lane_mode,
+        const ev_tstamp* afters,
+        unsigned int no_lanes);
 
 
 /*--------------------------------------------------
@@ -64,6 +245,7 @@ void bsat_toq_init(
         ev_tstamp after)
 {
     toq->cb = cb;
+    toq->rearm_cb = NULL;
     toq->head = toq->tail = NULL;
     toq->data = NULL;
 
@@ -74,140 +256,3162 @@ void bsat_toq_init(
     ev_timer_init(
         &(toq->timer), bsat_toq_dispatch, after, 0.0 );
     toq->timer.data = toq;
+    ev_check_init(&(toq->check), bsat_toq_check);
+    toq->check.data = toq;
+    toq->slack = 0.0;
+    toq->timer_at = 0.0;
+    toq->no_timer_arms = 0;
+    toq->clock = NULL;
+    toq->schedule = NULL;
+    toq->get_sqe = NULL;
+    toq->uring_data = 0;
+    toq->uring_state = URING_IDLE;
+    toq->uring_rearm = 0;
+    toq->service = NULL;
+    toq->service_at = -1.0;
+    toq->service_idx = SERVICE_NONE;
+    toq->service_ref = 0;
+    toq->executor = NULL;
+    toq->batch = NULL;
     toq->after = after;
+    toq->resolution = 0.0;
+    toq->no_skipped_resets = 0;
+    toq->deadline_mode = 0;
+    toq->trace = NULL;
+
+    toq->on_storm = NULL;
+    toq->storm_factor = 0.0;
+    toq->expiry_avg = 0.0;
+    toq->budget = 0;
+    toq->throttled = 0;
+    toq->drain = 0;
+
+    toq->parent = NULL;
+    toq->lanes = NULL;
+    toq->no_lanes = 0;
+    toq->lane_mode = LANES_NONE;
+    toq->jitter = 0.0;
+    toq->class_stats = NULL;
+
+    toq->cursor = NULL;
+    toq->generation = 0;
+    toq->dispatching = 0;
+    toq->reschedule = 0;
 }
 
 
 static void bsat_toq_dispatch(EV_P_ ev_timer* w, int revents)
 {
     bsat_toq_t* toq = w->data;
-    ev_tstamp threshold = ev_now(EV_A) - toq->after;
+    ev_tstamp now = TOQ_NOW(toq);
+    size_t limit = bsat_toq_dispatch_limit(toq);
+    size_t no_expired = 0;
+
+    /* Callbacks are free to start, stop, or reset any item, or to stop or
+     * clear the queue: we re-read the head of the queue on every iteration,
+     * stop early if the queue is stopped (i.e. the generation changes), and
+     * defer rescheduling the timer until we're done: */
+    unsigned int generation = toq->generation;
+    toq->dispatching = 1;
+    toq->reschedule = 1;
+
+    while( no_expired < limit && toq->generation == generation ) {
+        bsat_toq_t* lane = bsat_toq_next_due(toq, now);
+        if( !lane ) {
+            break;
+        }
 
-    while( toq->head ) {
-        bsat_timeout_t* current = toq->head;
-        if( current->tstamp <= threshold ) {
-            bsat_timeout_stop(toq, current);
+        bsat_timeout_t* current = lane->head;
+        no_expired++;
+        if( toq->class_stats ) {
+            bsat_toq_track_classes(toq, lane, now);
+        }
+
+        /* If there's another stage, move on to it — as of the deadline of
+         * the current stage, which keeps the next lane in order: */
+        if( toq->lane_mode == LANES_STAGES
+                && current->stage + 1 < toq->no_lanes ) {
+            ev_tstamp deadline = LANE_DEADLINE(lane);
+            bsat_toq_unlink(lane, current);
+            current->stage++;
+            bsat_toq_link(&toq->lanes[current->stage], current, deadline);
+            if( !IS_GROUP_NODE(current) ) {
+                bsat_toq_invoke(toq, current);
+            }
+            continue;
+        }
+
+        BSAT_TRACE(toq, current, BSAT_TRACE_EXPIRE, now);
+        if( IS_GROUP_NODE(current) ) {
+            bsat_toq_unlink(lane, current);
+            no_expired += bsat_toq_expire_group(
+                    toq, current->group, generation);
+            continue;
+        }
+
+        if( toq->rearm_cb ) {
+            bsat_toq_dispatch_rearm(toq, lane, current, now);
+            continue;
+        }
+
+        bsat_toq_unlink(lane, current);
+        if( toq->executor ) {
+            bsat_toq_offload(toq, current);
+        } else {
             toq->cb(toq, current);
+        }
+    }
+
+    toq->dispatching = 0;
+    if( toq->batch ) {
+        bsat_toq_submit(toq);
+    }
+    if( toq->generation == generation ) {
+        if( toq->class_stats ) {
+            bsat_toq_track_classes(toq, NULL, now);
+        }
+
+        if( toq->drain ) {
+            /* Draining is done once nothing is overdue: */
+            bsat_toq_t* lane = bsat_toq_next_lane(toq);
+            if( !lane || LANE_DEADLINE(lane) > now ) {
+                toq->drain = 0;
+            }
+        } else if( toq->budget ) {
+            bsat_toq_track_storm(toq, no_expired, now);
+        }
+    }
+
+    /* NOTE: if we're throttled, the head is overdue, so this fires on the
+     * very next loop iteration: */
+    if( toq->reschedule ) {
+        bsat_toq_schedule_next(toq);
+    }
+}
+
+
+/* Expire or re-arm the head of a lane, per the rearm callback: */
+static void bsat_toq_dispatch_rearm(
+        bsat_toq_t* toq,
+        bsat_toq_t* lane,
+        bsat_timeout_t* item,
+        ev_tstamp now)
+{
+    /* If the callback stops, resets, or moves the item, the cursor is
+     * cleared — and we don't touch the item again: */
+    toq->cursor = item;
+    ev_tstamp disposition = toq->rearm_cb(toq, item);
+    if( toq->cursor != item ) {
+        return;
+    }
+    toq->cursor = NULL;
+
+    if( disposition == BSAT_EXPIRE ) {
+        bsat_toq_unlink(lane, item);
+        return;
+    }
+
+    BSAT_TRACE(toq, item, BSAT_TRACE_START, now);
+    if( toq->lane_mode == LANES_STAGES ) {
+        /* Re-arming a staged timeout starts over from the first stage: */
+        bsat_toq_unlink(lane, item);
+        item->stage = 0;
+        bsat_toq_link(&toq->lanes[0], item, now);
+        return;
+    }
+
+    ev_tstamp rearmed = now;
+    if( disposition > 0.0 && disposition < lane->after ) {
+        /* Expire sooner — but not ahead of the end of the lane: */
+        rearmed = now + disposition - lane->after;
+        if( lane->tail != item && lane->tail->tstamp > rearmed ) {
+            rearmed = lane->tail->tstamp;
+        }
+    }
+    bsat_toq_rotate(lane, item, rearmed);
+    return;
+}
+
+
+/* Fan an expired group out to its items; returns the number expired: */
+static size_t bsat_toq_expire_group(
+        bsat_toq_t* toq,
+        bsat_timeout_group_t* group,
+        unsigned int generation)
+{
+    size_t no_expired = 0;
+
+    /* Move the items over to the expiring list, so that any added by the
+     * callbacks wait for the group's next expiry: */
+    group->expiring = group->head;
+    group->head = group->tail = NULL;
+
+    bsat_timeout_t* item;
+    while( (item = group->expiring) && toq->generation == generation ) {
+        group->expiring = item->next;
+        if( item->next ) {
+            item->next->prev = NULL;
+        }
+        item->next = item->prev = NULL;
+        item->group = NULL;
+        group->no_items--;
+        no_expired++;
+        bsat_toq_expire_item(toq, item);
+    }
+
+    /* If the queue was stopped, whatever's left stays in the group: */
+    if( (item = group->expiring) ) {
+        bsat_timeout_t* last = item;
+        while( last->next ) {
+            last = last->next;
+        }
+
+        last->next = group->head;
+        if( group->head ) {
+            group->head->prev = last;
         } else {
-            break;
+            group->tail = last;
         }
+        group->head = item;
+        group->expiring = NULL;
     }
+    return no_expired;
+}
 
-    bsat_toq_schedule_next(toq);
+
+/* Invoke whichever callback the queue is using: */
+static void bsat_toq_invoke(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( toq->rearm_cb ) {
+        toq->rearm_cb(toq, item);
+    } else {
+        toq->cb(toq, item);
+    }
+    return;
 }
 
 
-static void bsat_toq_schedule_next(bsat_toq_t* toq)
+/* Hand an unlinked item to the executor (if any), or invoke it here. Whoever
+ * expires items this way submits toq->batch once they're done: */
+static void bsat_toq_expire_item(bsat_toq_t* toq, bsat_timeout_t* item)
 {
-    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
-    bsat_timeout_t* next_item = toq->head;
-    if( next_item ) {
-        ev_tstamp delta_next =
-            (next_item->tstamp + toq->after) - ev_now(TOQ_LOOP);
-        ev_timer_set(&(toq->timer), delta_next, 0.0);
-        ev_timer_start(TOQ_LOOP_ &(toq->timer));
+    if( toq->executor && !toq->rearm_cb ) {
+        bsat_toq_offload(toq, item);
+    } else {
+        bsat_toq_invoke(toq, item);
     }
+    return;
 }
 
-void bsat_toq_stop(bsat_toq_t* toq)
+
+static size_t bsat_toq_dispatch_limit(bsat_toq_t* toq)
 {
-    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    if( toq->drain ) {
+        return toq->drain;
+    }
+
+    if( !toq->budget ) {
+        return (size_t)-1;
+    }
+
+    if( toq->throttled ) {
+        return toq->budget;
+    }
+
+    double limit = toq->storm_factor * toq->expiry_avg;
+    return limit > (double)toq->budget ? (size_t)limit : toq->budget;
 }
 
 
-void bsat_toq_clear(bsat_toq_t* toq)
+static void bsat_toq_track_storm(
+        bsat_toq_t* toq, size_t no_expired, ev_tstamp now)
 {
-    while( toq->head ) {
-        bsat_timeout_t* current = toq->head;
-        bsat_timeout_stop(toq, current);
+    bsat_toq_t* lane = bsat_toq_next_lane(toq);
+    int backlogged = lane && LANE_DEADLINE(lane) <= now;
+
+    if( toq->throttled ) {
+        if( !backlogged ) {
+            toq->throttled = 0;
+            if( toq->on_storm ) {
+                toq->on_storm(toq, 0);
+            }
+        }
+        return;
     }
 
-    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    if( !backlogged ) {
+        /* Exponential moving average of expirations per dispatch: */
+        toq->expiry_avg += ((double)no_expired - toq->expiry_avg) / 8.0;
+        return;
+    }
+
+    /* We hit the limit with overdue items remaining — that's a storm: */
+    toq->throttled = 1;
+    if( toq->on_storm ) {
+        size_t backlog = 0;
+        unsigned int no_lanes = toq->no_lanes ? toq->no_lanes : 1;
+        for( unsigned int i=0; i<no_lanes; i++ ) {
+            lane = toq->no_lanes ? &toq->lanes[i] : toq;
+            ev_tstamp threshold = now - lane->after;
+            bsat_timeout_t* current = lane->head;
+            while( current && current->tstamp <= threshold ) {
+                backlog++;
+                current = current->next;
+            }
+        }
+        toq->on_storm(toq, backlog);
+    }
+    return;
 }
 
 
-void bsat_toq_invoke_pending(bsat_toq_t* toq)
+/* Return the lane whose head expires soonest (or NULL, if all are empty): */
+static bsat_toq_t* bsat_toq_next_lane(bsat_toq_t* toq)
 {
-    while( toq->head ) {
-        bsat_timeout_t* current = toq->head;
-        bsat_timeout_stop(toq, current);
-        toq->cb(toq, current);
+    if( !toq->no_lanes ) {
+        return toq->head ? toq : NULL;
     }
 
-    bsat_toq_clear(toq);
+    bsat_toq_t* next = NULL;
+    for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+        bsat_toq_t* lane = &toq->lanes[i];
+        if( lane->head
+                && (!next || LANE_DEADLINE(lane) < LANE_DEADLINE(next)) ) {
+            next = lane;
+        }
+    }
+    return next;
 }
 
 
-/*--------------------------------------------------
- * BSAT Timeout Functions:
- *--------------------------------------------------*/
-void bsat_timeout_init(bsat_timeout_t* timeout)
+/* Return the lane to expire from next (or NULL, if nothing is due yet): */
+static bsat_toq_t* bsat_toq_next_due(bsat_toq_t* toq, ev_tstamp now)
 {
-    timeout->tstamp = (ev_tstamp)-1.0;
-    timeout->prev = timeout->next = NULL;
-    timeout->data = NULL;
+    if( toq->lane_mode == LANES_CLASSES ) {
+        /* Whatever's due goes in priority order: */
+        for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+            bsat_toq_t* lane = &toq->lanes[i];
+            if( lane->head && LANE_DEADLINE(lane) <= now ) {
+                return lane;
+            }
+        }
+        return NULL;
+    }
+
+    bsat_toq_t* lane = bsat_toq_next_lane(toq);
+    return (lane && LANE_DEADLINE(lane) <= now) ? lane : NULL;
 }
 
 
-void bsat_timeout_start(bsat_toq_t* toq, bsat_timeout_t* item)
+/* Update class stats for an expiry from lane (or, if lane is NULL, for the
+ * end of a dispatch): */
+static void bsat_toq_track_classes(
+        bsat_toq_t* toq, bsat_toq_t* lane, ev_tstamp now)
 {
-    /* Don't do anything if it's already started: */
-    if( item->tstamp > 0.0 ) {
+    if( lane ) {
+        bsat_class_stats_t* stats = &toq->class_stats[lane - toq->lanes];
+        ev_tstamp lateness = now - LANE_DEADLINE(lane);
+        stats->expired++;
+        stats->lateness_sum += lateness;
+        if( lateness > stats->lateness_max ) {
+            stats->lateness_max = lateness;
+        }
         return;
     }
 
-    item->tstamp = ev_now(TOQ_LOOP);
-    if( toq->tail ) {
-        item->prev = toq->tail;
-        toq->tail->next = item;
-        toq->tail = item;
-    } else {
-        toq->head = toq->tail = item;
-        bsat_toq_schedule_next(toq);
+    for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+        lane = &toq->lanes[i];
+        if( lane->head && LANE_DEADLINE(lane) <= now ) {
+            toq->class_stats[i].deferred++;
+        }
     }
     return;
 }
 
 
-void bsat_timeout_reset(bsat_toq_t* toq, bsat_timeout_t* item)
+/* Return the lane a given item belongs to: */
+static bsat_toq_t* bsat_toq_route(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    switch( toq->lane_mode ) {
+        case LANES_JITTER:
+            {
+                /* Spread items across lanes using a hash of their address: */
+                uint64_t hash =
+                    (uint64_t)(uintptr_t)item * 0x9e3779b97f4a7c15ULL;
+                return &toq->lanes[(hash >> 32) % toq->no_lanes];
+            }
+        case LANES_STAGES:
+            return &toq->lanes[item->stage];
+        case LANES_CLASSES:
+            return &toq->lanes[item->cls < toq->no_lanes ?
+                item->cls : toq->no_lanes - 1];
+        default:
+            return toq;
+    }
+}
+
+
+static void bsat_toq_free_lanes(bsat_toq_t* toq)
 {
-    bsat_timeout_stop(toq, item);
-    bsat_timeout_start(toq, item);
+    free(toq->lanes);
+    free(toq->class_stats);
+    toq->lanes = NULL;
+    toq->class_stats = NULL;
+    toq->no_lanes = 0;
+    toq->lane_mode = LANES_NONE;
+    toq->jitter = 0.0;
     return;
 }
 
 
-void bsat_timeout_stop(bsat_toq_t* toq, bsat_timeout_t* item)
+/* Allocate lanes with the given timeout periods: */
+static int bsat_toq_alloc_lanes(
+        bsat_toq_t* toq,
+        int lane_mode,
+        const ev_tstamp* afters,
+        unsigned int no_lanes)
+{
+    bsat_toq_t* lanes = malloc(no_lanes * sizeof(bsat_toq_t));
+    if( !lanes ) {
+        return -1;
+    }
+
+    for( unsigned int i=0; i<no_lanes; i++ ) {
+        bsat_toq_init(TOQ_LOOP_ &lanes[i], toq->cb, afters[i]);
+        lanes[i].parent = toq;
+    }
+
+    toq->lanes = lanes;
+    toq->no_lanes = no_lanes;
+    toq->lane_mode = lane_mode;
+    return 0;
+}
+
+
+static void bsat_toq_schedule_next(bsat_toq_t* toq)
 {
-    if( item->tstamp < 0.0 ) {
+    /* Lanes share their parent's timer: */
+    if( toq->parent ) {
+        toq = toq->parent;
+    }
+
+    /* Dispatch takes care of this once it's done: */
+    if( toq->dispatching ) {
+        toq->reschedule = 1;
         return;
     }
 
-    item->tstamp = (ev_tstamp)-1.0;
-    bsat_timeout_t* next = item->next;
-    bsat_timeout_t* prev = item->prev;
+    /* With io_uring, the timer is an SQE: */
+    if( toq->get_sqe ) {
+        bsat_toq_uring_arm(toq);
+        return;
+    }
 
-    if( prev ) {
-        prev->next = next;
+    bsat_toq_t* next_lane;
+    if( toq->schedule ) {
+        /* Someone else's timer, so just pass on the delay: */
+        ev_tstamp delay = -1.0;
+        if( (next_lane = bsat_toq_next_lane(toq)) ) {
+            delay = LANE_DEADLINE(next_lane) - TOQ_NOW(toq);
+            if( delay < 0.0 ) {
+                delay = 0.0;
+            }
+        }
+        toq->schedule(toq, delay);
+        toq->no_timer_arms++;
+        return;
     }
-    if( next ) {
-        next->prev = prev;
+
+    /* In pull mode, bsat_toq_poll_expired does the work of the timer: */
+    if( toq->clock ) {
+        return;
     }
 
-    if( toq->head == item ) {
-        toq->head = next;
+    next_lane = bsat_toq_next_lane(toq);
+    if( !next_lane ) {
+        ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+        return;
     }
-    if( toq->tail == item ) {
-        toq->tail = prev;
+
+    ev_tstamp deadline = LANE_DEADLINE(next_lane);
+    if( toq->slack > 0.0 ) {
+        /* In adaptive mode, the check watcher expires items on time while
+         * the loop is busy; the timer only has to go off within slack of the
+         * deadline, in case the loop goes idle: */
+        bsat_toq_check_start(toq);
+        if( ev_is_active(&(toq->timer))
+                && toq->timer_at <= deadline + toq->slack ) {
+            return;
+        }
+        deadline += toq->slack;
     }
 
-    item->next = item->prev = NULL;
+    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    ev_timer_set(&(toq->timer), deadline - ev_now(TOQ_LOOP), 0.0);
+    ev_timer_start(TOQ_LOOP_ &(toq->timer));
+    toq->timer_at = deadline;
+    toq->no_timer_arms++;
+}
+
+
+/* Once per loop iteration, in adaptive mode: */
+static void bsat_toq_check(EV_P_ ev_check* w, int revents)
+{
+    bsat_toq_t* toq = w->data;
+    bsat_toq_t* lane = bsat_toq_next_lane(toq);
+    if( lane && LANE_DEADLINE(lane) <= ev_now(EV_A) ) {
+        bsat_toq_dispatch(EV_A_ &(toq->timer), EV_TIMER);
+    }
+}
+
+
+static void bsat_toq_check_start(bsat_toq_t* toq)
+{
+    if( !ev_is_active(&(toq->check)) ) {
+        ev_check_start(TOQ_LOOP_ &(toq->check));
+
+        /* Only the timer should keep the loop alive: */
+        ev_unref(TOQ_LOOP);
+    }
     return;
 }
 
 
-int bsat_timeout_is_active(bsat_timeout_t* item)
+static void bsat_toq_check_stop(bsat_toq_t* toq)
 {
-    return item->tstamp > 0.0;
+    if( ev_is_active(&(toq->check)) ) {
+        ev_ref(TOQ_LOOP);
+        ev_check_stop(TOQ_LOOP_ &(toq->check));
+    }
+    return;
+}
+
+int bsat_toq_set_after(bsat_toq_t* toq, ev_tstamp after, size_t drain)
+{
+    if( after <= 0.0 || toq->lane_mode == LANES_CLASSES
+            || (toq->lane_mode == LANES_JITTER && after <= toq->jitter) ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ev_tstamp delta = after - toq->after;
+    if( toq->lane_mode == LANES_JITTER ) {
+        for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+            toq->lanes[i].after += delta;
+        }
+    } else if( toq->lane_mode == LANES_STAGES ) {
+        toq->lanes[0].after = after;
+    }
+    toq->after = after;
+    if( toq->trace ) {
+        toq->trace->after = after;
+    }
+
+    if( drain && delta < 0.0 ) {
+        toq->drain = drain;
+    }
+
+    bsat_toq_schedule_next(toq);
+    return 0;
+}
+
+
+void bsat_toq_set_storm(
+        bsat_toq_t* toq,
+        bsat_storm_cb_t on_storm,
+        double factor,
+        size_t budget)
+{
+    toq->on_storm = on_storm;
+    toq->storm_factor = factor;
+    toq->budget = budget;
+    toq->throttled = 0;
+    return;
+}
+
+
+int bsat_toq_set_jitter(
+        bsat_toq_t* toq, ev_tstamp jitter, unsigned int no_lanes)
+{
+    if( jitter < 0.0 || jitter >= toq->after ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( bsat_toq_next_lane(toq) || toq->dispatching ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if( toq->lane_mode != LANES_NONE && toq->lane_mode != LANES_JITTER ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bsat_toq_free_lanes(toq);
+    if( jitter == 0.0 || no_lanes < 2 ) {
+        return 0;
+    }
+
+    ev_tstamp* afters = malloc(no_lanes * sizeof(ev_tstamp));
+    if( !afters ) {
+        return -1;
+    }
+
+    /* Lane offsets are evenly spaced across [-jitter, +jitter]: */
+    for( unsigned int i=0; i<no_lanes; i++ ) {
+        afters[i] = toq->after - jitter + (2.0 * jitter * i) / (no_lanes - 1);
+    }
+
+    int rc = bsat_toq_alloc_lanes(toq, LANES_JITTER, afters, no_lanes);
+    free(afters);
+    if( !rc ) {
+        toq->jitter = jitter;
+    }
+    return rc;
+}
+
+
+int bsat_toq_set_stages(
+        bsat_toq_t* toq, const ev_tstamp* afters, unsigned int no_stages)
+{
+    if( toq->lane_mode != LANES_NONE && toq->lane_mode != LANES_STAGES ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for( unsigned int i=0; i<no_stages; i++ ) {
+        if( afters[i] <= 0.0 ) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if( bsat_toq_next_lane(toq) || toq->dispatching ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    bsat_toq_free_lanes(toq);
+    if( no_stages < 2 ) {
+        if( no_stages ) {
+            toq->after = afters[0];
+            if( toq->trace ) {
+                toq->trace->after = toq->after;
+            }
+        }
+        return 0;
+    }
+
+    if( bsat_toq_alloc_lanes(toq, LANES_STAGES, afters, no_stages) ) {
+        return -1;
+    }
+    toq->after = afters[0];
+    if( toq->trace ) {
+        toq->trace->after = toq->after;
+    }
+    return 0;
 }
 
+
+int bsat_toq_set_classes(
+        bsat_toq_t* toq, const ev_tstamp* afters, unsigned int no_classes)
+{
+    if( toq->lane_mode != LANES_NONE && toq->lane_mode != LANES_CLASSES ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for( unsigned int i=0; i<no_classes; i++ ) {
+        if( afters[i] <= 0.0 ) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if( bsat_toq_next_lane(toq) || toq->dispatching ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    bsat_toq_free_lanes(toq);
+    if( no_classes < 2 ) {
+        return 0;
+    }
+
+    bsat_class_stats_t* stats = calloc(no_classes, sizeof(bsat_class_stats_t));
+    if( !stats ) {
+        return -1;
+    }
+
+    if( bsat_toq_alloc_lanes(toq, LANES_CLASSES, afters, no_classes) ) {
+        free(stats);
+        return -1;
+    }
+    toq->class_stats = stats;
+    return 0;
+}
+
+
+bsat_class_stats_t* bsat_toq_class_stats(bsat_toq_t* toq, unsigned int cls)
+{
+    if( !toq->class_stats || cls >= toq->no_lanes ) {
+        return NULL;
+    }
+    return &toq->class_stats[cls];
+}
+
+
+void bsat_toq_set_resolution(bsat_toq_t* toq, ev_tstamp resolution)
+{
+    toq->resolution = resolution;
+    return;
+}
+
+
+void bsat_toq_set_deadline_mode(bsat_toq_t* toq, int enabled)
+{
+    toq->deadline_mode = enabled;
+    return;
+}
+
+
+void bsat_toq_set_rearm(bsat_toq_t* toq, bsat_rearm_cb_t rearm_cb)
+{
+    toq->rearm_cb = rearm_cb;
+    return;
+}
+
+
+void bsat_toq_set_adaptive(bsat_toq_t* toq, ev_tstamp slack)
+{
+    toq->slack = slack > 0.0 ? slack : 0.0;
+    if( !toq->slack ) {
+        bsat_toq_check_stop(toq);
+    }
+
+    /* Start over, so the timer is set per the new mode: */
+    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    bsat_toq_schedule_next(toq);
+    return;
+}
+
+
+void bsat_toq_set_poll_mode(bsat_toq_t* toq, bsat_clock_cb_t clock)
+{
+    toq->clock = clock;
+    if( clock ) {
+        ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+        bsat_toq_check_stop(toq);
+    } else {
+        bsat_toq_schedule_next(toq);
+    }
+    return;
+}
+
+
+int bsat_toq_set_uring(
+        bsat_toq_t* toq,
+        bsat_sqe_cb_t get_sqe,
+        bsat_clock_cb_t clock,
+        uint64_t user_data)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    if( !get_sqe || !clock ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    bsat_toq_check_stop(toq);
+    toq->get_sqe = get_sqe;
+    toq->clock = clock;
+    toq->uring_data = user_data;
+    toq->uring_state = URING_IDLE;
+    toq->uring_rearm = 0;
+    bsat_toq_schedule_next(toq);
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif /* HAVE_LINUX_IO_URING_H */
+}
+
+
+void bsat_toq_uring_complete(bsat_toq_t* toq, int32_t res)
+{
+    /* Only the timeout itself completes with these — anything else is the
+     * result of moving or cancelling it: */
+    if( res != -ETIME && res != -ECANCELED ) {
+        return;
+    }
+
+    int state = toq->uring_state;
+    toq->uring_state = URING_IDLE;
+    if( state == URING_CANCELING ) {
+        /* Items were started while the old timeout was on its way out: */
+        if( toq->uring_rearm ) {
+            toq->uring_rearm = 0;
+            bsat_toq_schedule_next(toq);
+        }
+        return;
+    }
+
+    if( res == -ETIME ) {
+        bsat_toq_dispatch(TOQ_LOOP_ &(toq->timer), EV_TIMER);
+    }
+    return;
+}
+
+
+int bsat_toq_set_scheduler(
+        bsat_toq_t* toq,
+        bsat_schedule_cb_t schedule,
+        bsat_clock_cb_t clock)
+{
+    if( schedule && !clock ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( toq->schedule ) {
+        toq->schedule(toq, -1.0);
+    }
+
+    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    bsat_toq_check_stop(toq);
+    toq->schedule = schedule;
+    toq->clock = schedule ? clock : NULL;
+    bsat_toq_schedule_next(toq);
+    return 0;
+}
+
+
+void bsat_toq_expire_due(bsat_toq_t* toq)
+{
+    bsat_toq_dispatch(TOQ_LOOP_ &(toq->timer), EV_TIMER);
+    return;
+}
+
+
+/* Prepare (or move) the io_uring timeout for the next deadline: */
+static void bsat_toq_uring_arm(bsat_toq_t* toq)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    /* There can only be one timeout per queue (they share user_data): */
+    if( toq->uring_state == URING_CANCELING ) {
+        toq->uring_rearm = 1;
+        return;
+    }
+
+    /* If the current one goes off, there's just nothing to expire: */
+    bsat_toq_t* next_lane = bsat_toq_next_lane(toq);
+    if( !next_lane ) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = toq->get_sqe(toq);
+    if( !sqe ) {
+        return;
+    }
+
+    ev_tstamp delta = LANE_DEADLINE(next_lane) - TOQ_NOW(toq);
+    if( delta < 0.0 ) {
+        delta = 0.0;
+    }
+
+    /* NOTE: this is a struct __kernel_timespec, which is read on submit: */
+    toq->uring_ts[0] = (int64_t)delta;
+    toq->uring_ts[1] = (int64_t)((delta - (ev_tstamp)toq->uring_ts[0]) * 1e9);
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = toq->uring_data;
+    if( toq->uring_state == URING_ARMED ) {
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->timeout_flags = IORING_TIMEOUT_UPDATE;
+        sqe->addr = toq->uring_data;
+        sqe->addr2 = (uint64_t)(uintptr_t)toq->uring_ts;
+    } else {
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = (uint64_t)(uintptr_t)toq->uring_ts;
+        sqe->len = 1;
+        toq->uring_state = URING_ARMED;
+    }
+    toq->no_timer_arms++;
+#endif /* HAVE_LINUX_IO_URING_H */
+    return;
+}
+
+
+/* Cancel the io_uring timeout, if there is one: */
+static void bsat_toq_uring_disarm(bsat_toq_t* toq)
+{
+    toq->uring_rearm = 0;
+#ifdef HAVE_LINUX_IO_URING_H
+    if( toq->uring_state != URING_ARMED ) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = toq->get_sqe(toq);
+    if( !sqe ) {
+        return;
+    }
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+    sqe->addr = toq->uring_data;
+    sqe->user_data = toq->uring_data;
+    toq->uring_state = URING_CANCELING;
+#endif /* HAVE_LINUX_IO_URING_H */
+    return;
+}
+
+
+size_t bsat_toq_poll_expired(
+        bsat_toq_t* toq,
+        ev_tstamp now,
+        bsat_timeout_t** out,
+        size_t max,
+        ev_tstamp* next_deadline)
+{
+    size_t no_expired = 0;
+    bsat_toq_t* lane;
+    while( no_expired < max && (lane = bsat_toq_next_due(toq, now)) ) {
+        bsat_timeout_t* current = lane->head;
+        out[no_expired++] = current;
+
+        /* Same as bsat_toq_dispatch — move on to the next stage, if any: */
+        if( toq->lane_mode == LANES_STAGES
+                && current->stage + 1 < toq->no_lanes ) {
+            ev_tstamp deadline = LANE_DEADLINE(lane);
+            bsat_toq_unlink(lane, current);
+            current->stage++;
+            bsat_toq_link(&toq->lanes[current->stage], current, deadline);
+            continue;
+        }
+
+        BSAT_TRACE(toq, current, BSAT_TRACE_EXPIRE, now);
+        bsat_toq_unlink(lane, current);
+    }
+
+    if( next_deadline ) {
+        lane = bsat_toq_next_lane(toq);
+        *next_deadline = lane ? LANE_DEADLINE(lane) : (ev_tstamp)-1.0;
+    }
+    return no_expired;
+}
+
+
+void bsat_toq_stop(bsat_toq_t* toq)
+{
+    ev_timer_stop(TOQ_LOOP_ &(toq->timer));
+    bsat_toq_check_stop(toq);
+    if( toq->get_sqe ) {
+        bsat_toq_uring_disarm(toq);
+    }
+    if( toq->schedule ) {
+        toq->schedule(toq, -1.0);
+    }
+
+    /* If we're dispatching, this ends it (and keeps the timer stopped): */
+    toq->generation++;
+    toq->reschedule = 0;
+}
+
+
+void bsat_toq_clear(bsat_toq_t* toq)
+{
+    bsat_toq_t* lane;
+    while( (lane = bsat_toq_next_lane(toq)) ) {
+        bsat_timeout_t* current = lane->head;
+        bsat_timeout_stop(toq, current);
+    }
+
+    bsat_toq_stop(toq);
+}
+
+
+void bsat_toq_invoke_pending(bsat_toq_t* toq)
+{
+    ev_tstamp now = TOQ_NOW(toq);
+    bsat_toq_t* lane;
+    while( (lane = bsat_toq_next_lane(toq)) ) {
+        bsat_timeout_t* current = lane->head;
+        BSAT_TRACE(toq, current, BSAT_TRACE_EXPIRE, now);
+        bsat_toq_unlink(lane, current);
+        if( IS_GROUP_NODE(current) ) {
+            bsat_toq_expire_group(toq, current->group, toq->generation);
+        } else {
+            bsat_toq_expire_item(toq, current);
+        }
+    }
+
+    if( toq->batch && !toq->dispatching ) {
+        bsat_toq_submit(toq);
+    }
+    bsat_toq_clear(toq);
+}
+
+
+static void bsat_toq_link(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp now)
+{
+    if( bsat_toq_append(toq, item, now) ) {
+        bsat_toq_schedule_next(toq);
+    }
+    return;
+}
+
+
+/* Append an item to a lane; returns 1 if the lane was empty (i.e. the timer
+ * needs to be rescheduled), 0 otherwise: */
+static int bsat_toq_append(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp now)
+{
+    item->tstamp = now;
+    item->active = 1;
+    if( toq->tail ) {
+        item->prev = toq->tail;
+        toq->tail->next = item;
+        toq->tail = item;
+        return 0;
+    }
+
+    toq->head = toq->tail = item;
+    return 1;
+}
+
+
+static void bsat_toq_unlink(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    /* Let dispatch know the item is spoken for (see bsat_toq_dispatch): */
+    bsat_toq_t* root = toq->parent ? toq->parent : toq;
+    if( root->cursor == item ) {
+        root->cursor = NULL;
+    }
+
+    item->tstamp = (ev_tstamp)-1.0;
+    item->active = 0;
+    bsat_timeout_t* next = item->next;
+    bsat_timeout_t* prev = item->prev;
+
+    if( prev ) {
+        prev->next = next;
+    }
+    if( next ) {
+        next->prev = prev;
+    }
+
+    if( toq->head == item ) {
+        toq->head = next;
+    }
+    if( toq->tail == item ) {
+        toq->tail = prev;
+    }
+
+    item->next = item->prev = NULL;
+    return;
+}
+
+
+/* Move the head of a queue to its tail, with a new timestamp: */
+static void bsat_toq_rotate(
+        bsat_toq_t* toq, bsat_timeout_t* item, ev_tstamp tstamp)
+{
+    item->tstamp = tstamp;
+    if( toq->tail == item ) {
+        return;
+    }
+
+    toq->head = item->next;
+    toq->head->prev = NULL;
+    item->next = NULL;
+    item->prev = toq->tail;
+    toq->tail->next = item;
+    toq->tail = item;
+    return;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Tracing Functions:
+ *--------------------------------------------------*/
+int bsat_toq_trace_open(bsat_toq_t* toq, const char* path, size_t capacity)
+{
+    if( !capacity || capacity > UINT32_MAX ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t len = sizeof(bsat_trace_header_t)
+        + capacity * sizeof(bsat_trace_event_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if( fd < 0 ) {
+        return -1;
+    }
+
+    if( ftruncate(fd, (off_t)len) ) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    void* region = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( region == MAP_FAILED ) {
+        return -1;
+    }
+
+    /* If we were already tracing, switch over to the new file: */
+    bsat_toq_trace_close(toq);
+
+    bsat_trace_header_t* trace = region;
+    memcpy(trace->magic, BSAT_TRACE_MAGIC, sizeof(trace->magic));
+    trace->version = BSAT_TRACE_VERSION;
+    trace->capacity = (uint32_t)capacity;
+    trace->count = 0;
+    trace->after = toq->after;
+    toq->trace = trace;
+    return 0;
+}
+
+
+void bsat_toq_trace_close(bsat_toq_t* toq)
+{
+    bsat_trace_header_t* trace = toq->trace;
+    if( !trace ) {
+        return;
+    }
+
+    size_t len = sizeof(bsat_trace_header_t)
+        + trace->capacity * sizeof(bsat_trace_event_t);
+    toq->trace = NULL;
+    munmap(trace, len);
+    return;
+}
+
+
+static void bsat_trace_record(
+        bsat_trace_header_t* trace,
+        bsat_timeout_t* item,
+        bsat_trace_type_t type,
+        ev_tstamp now)
+{
+    bsat_trace_event_t* events = (bsat_trace_event_t*)(trace + 1);
+    bsat_trace_event_t* event = &events[trace->count % trace->capacity];
+    event->tstamp = now;
+    event->item = (uint64_t)(uintptr_t)item;
+    event->type = type;
+    event->reserved = 0;
+    trace->count++;
+    return;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Snapshot Functions:
+ *--------------------------------------------------*/
+ssize_t bsat_toq_snapshot(
+        bsat_toq_t* toq, bsat_key_cb_t key_cb, void* buf, size_t len)
+{
+    unsigned int no_lanes = toq->no_lanes ? toq->no_lanes : 1;
+    size_t count = 0;
+    for( unsigned int i=0; i<no_lanes; i++ ) {
+        bsat_timeout_t* cur = LANE_AT(toq, i)->head;
+        while( cur ) {
+            count++;
+            cur = cur->next;
+        }
+    }
+
+    size_t needed = sizeof(bsat_snapshot_header_t)
+        + count * sizeof(bsat_snapshot_record_t);
+    if( !buf ) {
+        return (ssize_t)needed;
+    }
+
+    if( len < needed || count > UINT32_MAX ) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    bsat_timeout_t** cursors = malloc(no_lanes * sizeof(bsat_timeout_t*));
+    if( !cursors ) {
+        return -1;
+    }
+
+    for( unsigned int i=0; i<no_lanes; i++ ) {
+        cursors[i] = LANE_AT(toq, i)->head;
+    }
+
+    /* NOTE: buf may come straight off of a socket, so we don't assume it's
+     * aligned: */
+    bsat_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BSAT_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = BSAT_SNAPSHOT_VERSION;
+    header.count = (uint32_t)count;
+    header.after = toq->after;
+    memcpy(buf, &header, sizeof(header));
+
+    char* out = (char*)buf + sizeof(header);
+    ev_tstamp now = TOQ_NOW(toq);
+    for( size_t n=0; n<count; n++ ) {
+        /* Each lane is in order, so merging them gives us deadline order: */
+        unsigned int next = no_lanes;
+        ev_tstamp next_deadline = 0.0;
+        for( unsigned int i=0; i<no_lanes; i++ ) {
+            if( !cursors[i] ) {
+                continue;
+            }
+
+            ev_tstamp deadline = cursors[i]->tstamp + LANE_AT(toq, i)->after;
+            if( next == no_lanes || deadline < next_deadline ) {
+                next = i;
+                next_deadline = deadline;
+            }
+        }
+
+        bsat_timeout_t* item = cursors[next];
+        cursors[next] = item->next;
+
+        bsat_snapshot_record_t record;
+        record.remaining = next_deadline > now ? next_deadline - now : 0.0;
+        record.key = key_cb(toq, item);
+        record.stage = item->stage;
+        record.reserved = 0;
+        memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+    }
+
+    free(cursors);
+    return (ssize_t)needed;
+}
+
+
+ssize_t bsat_toq_restore(
+        bsat_toq_t* toq,
+        bsat_lookup_cb_t lookup_cb,
+        const void* buf,
+        size_t len)
+{
+    bsat_snapshot_header_t header;
+    if( len < sizeof(header) ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(&header, buf, sizeof(header));
+    if( memcmp(header.magic, BSAT_SNAPSHOT_MAGIC, sizeof(header.magic))
+            || header.version != BSAT_SNAPSHOT_VERSION
+            || (len - sizeof(header)) / sizeof(bsat_snapshot_record_t)
+                < header.count ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( bsat_toq_next_lane(toq) || toq->dispatching ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    const char* in = (const char*)buf + sizeof(header);
+    ev_tstamp now = TOQ_NOW(toq);
+    ssize_t no_restored = 0;
+    for( uint32_t n=0; n<header.count; n++ ) {
+        bsat_snapshot_record_t record;
+        memcpy(&record, in, sizeof(record));
+        in += sizeof(record);
+
+        bsat_timeout_t* item = lookup_cb(toq, record.key);
+        if( !item || item->active ) {
+            continue;
+        }
+
+        item->stage = 0;
+        if( toq->lane_mode == LANES_STAGES ) {
+            item->stage = record.stage < toq->no_lanes ?
+                record.stage : toq->no_lanes - 1;
+        }
+
+        bsat_toq_t* lane = bsat_toq_route(toq, item);
+        ev_tstamp remaining = record.remaining;
+        if( remaining > lane->after ) {
+            remaining = lane->after;
+        } else if( remaining < 0.0 ) {
+            remaining = 0.0;
+        }
+
+        /* Records are in deadline order, so this is an append — but keep the
+         * lane in order, even if the snapshot isn't: */
+        ev_tstamp tstamp = now + remaining - lane->after;
+        if( lane->tail && lane->tail->tstamp > tstamp ) {
+            tstamp = lane->tail->tstamp;
+        }
+
+        BSAT_TRACE(toq, item, BSAT_TRACE_START, now);
+        bsat_toq_link(lane, item, tstamp);
+        no_restored++;
+    }
+    return no_restored;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Eviction Functions:
+ *--------------------------------------------------*/
+size_t bsat_toq_evict_oldest(bsat_toq_t* toq, size_t n)
+{
+    return bsat_toq_evict(toq, TOQ_NOW(toq), n);
+}
+
+
+size_t bsat_toq_evict_idle_longer_than(
+        bsat_toq_t* toq, ev_tstamp secs, size_t n)
+{
+    return bsat_toq_evict(toq, TOQ_NOW(toq) - secs, n ? n : (size_t)-1);
+}
+
+
+/* Return the lane whose head has been idle the longest (or NULL): */
+static bsat_toq_t* bsat_toq_oldest_lane(bsat_toq_t* toq)
+{
+    if( !toq->no_lanes ) {
+        return toq->head ? toq : NULL;
+    }
+
+    bsat_toq_t* oldest = NULL;
+    for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+        bsat_toq_t* lane = &toq->lanes[i];
+        if( lane->head
+                && (!oldest || lane->head->tstamp < oldest->head->tstamp) ) {
+            oldest = lane;
+        }
+    }
+    return oldest;
+}
+
+
+/* Expire up to n items (re)started at or before threshold, oldest first: */
+static size_t bsat_toq_evict(bsat_toq_t* toq, ev_tstamp threshold, size_t n)
+{
+    unsigned int generation = toq->generation;
+    ev_tstamp now = TOQ_NOW(toq);
+    size_t no_evicted = 0;
+
+    bsat_toq_t* lane;
+    while( no_evicted < n && toq->generation == generation
+            && (lane = bsat_toq_oldest_lane(toq))
+            && lane->head->tstamp <= threshold ) {
+        bsat_timeout_t* current = lane->head;
+        BSAT_TRACE(toq, current, BSAT_TRACE_EXPIRE, now);
+        bsat_toq_unlink(lane, current);
+        if( IS_GROUP_NODE(current) ) {
+            no_evicted += bsat_toq_expire_group(
+                    toq, current->group, generation);
+        } else {
+            no_evicted++;
+            bsat_toq_expire_item(toq, current);
+        }
+    }
+
+    /* Dispatch submits its own batch when it's done, if we're inside it: */
+    if( toq->batch && !toq->dispatching ) {
+        bsat_toq_submit(toq);
+    }
+
+    /* The timer may have been set for an item that's gone now: */
+    if( no_evicted && toq->generation == generation ) {
+        bsat_toq_schedule_next(toq);
+    }
+    return no_evicted;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Close whatever bsat_pressure_open has opened so far, preserving errno: */
+static int bsat_pressure_abort(int psi_fd, int epoll_fd)
+{
+    int err = errno;
+    if( epoll_fd >= 0 ) {
+        close(epoll_fd);
+    }
+    close(psi_fd);
+    errno = err;
+    return -1;
+}
+
+
+static void bsat_pressure_ready(EV_P_ ev_io* w, int revents)
+{
+    bsat_pressure_t* pressure = w->data;
+    struct epoll_event event;
+    if( epoll_wait(w->fd, &event, 1, 0) < 1 ) {
+        return;
+    }
+
+    /* The cgroup went away — there's nothing left to watch: */
+    if( event.events & EPOLLERR ) {
+        ev_io_stop(EV_A_ w);
+        return;
+    }
+
+    size_t no_evicted = bsat_toq_evict_oldest(pressure->toq, pressure->batch);
+    if( pressure->on_pressure ) {
+        pressure->on_pressure(pressure, no_evicted);
+    }
+    return;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+int bsat_pressure_open(
+        bsat_pressure_t* pressure,
+        bsat_toq_t* toq,
+        const char* path,
+        const char* trigger,
+        size_t batch)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    int psi_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if( psi_fd < 0 ) {
+        return -1;
+    }
+
+    /* NOTE: the kernel expects the trigger's terminating NUL, too: */
+    if( write(psi_fd, trigger, strlen(trigger) + 1) < 0 ) {
+        return bsat_pressure_abort(psi_fd, -1);
+    }
+
+    /* PSI signals POLLPRI, which ev_io can't watch for — but it can watch an
+     * epoll descriptor which does: */
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if( epoll_fd < 0 ) {
+        return bsat_pressure_abort(psi_fd, -1);
+    }
+
+    struct epoll_event event = { .events = EPOLLPRI, .data.fd = psi_fd };
+    if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, psi_fd, &event) ) {
+        return bsat_pressure_abort(psi_fd, epoll_fd);
+    }
+
+    pressure->psi_fd = psi_fd;
+    pressure->toq = toq;
+    pressure->batch = batch;
+    pressure->on_pressure = NULL;
+    pressure->data = NULL;
+    ev_io_init(&(pressure->io), bsat_pressure_ready, epoll_fd, EV_READ);
+    pressure->io.data = pressure;
+    ev_io_start(TOQ_LOOP_ &(pressure->io));
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif /* HAVE_SYS_EPOLL_H */
+}
+
+
+void bsat_pressure_close(bsat_pressure_t* pressure)
+{
+#ifdef HAVE_SYS_EPOLL_H
+#if EV_MULTIPLICITY
+    bsat_toq_t* toq = pressure->toq;
+#endif /* EV_MULTIPLICITY */
+    ev_io_stop(TOQ_LOOP_ &(pressure->io));
+    close(pressure->io.fd);
+    close(pressure->psi_fd);
+    pressure->psi_fd = -1;
+#endif /* HAVE_SYS_EPOLL_H */
+    return;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Timer Service Functions:
+ *--------------------------------------------------*/
+int bsat_service_open(bsat_service_t* service)
+{
+    service->heap = NULL;
+    service->no_pending = 0;
+    service->no_queues = 0;
+    service->capacity = 0;
+    service->wake_at = -1.0;
+    service->running = 1;
+    service->no_wakeups = 0;
+    service->no_notifications = 0;
+    service->data = NULL;
+
+    /* NOTE: the default condvar clock is CLOCK_REALTIME — the same timeline
+     * as ev_time() and ev_now(): */
+    pthread_mutex_init(&(service->lock), NULL);
+    pthread_cond_init(&(service->cond), NULL);
+    int rc = pthread_create(&(service->thread), NULL, bsat_service_run, service);
+    if( rc ) {
+        pthread_cond_destroy(&(service->cond));
+        pthread_mutex_destroy(&(service->lock));
+        errno = rc;
+        return -1;
+    }
+    return 0;
+}
+
+
+void bsat_service_close(bsat_service_t* service)
+{
+    pthread_mutex_lock(&(service->lock));
+    service->running = 0;
+    pthread_cond_signal(&(service->cond));
+    pthread_mutex_unlock(&(service->lock));
+
+    pthread_join(service->thread, NULL);
+    pthread_cond_destroy(&(service->cond));
+    pthread_mutex_destroy(&(service->lock));
+    free(service->heap);
+    service->heap = NULL;
+    service->capacity = 0;
+    return;
+}
+
+
+int bsat_service_add(bsat_service_t* service, bsat_toq_t* toq)
+{
+    if( toq->service ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* Every queue gets a slot up front, so posting never allocates: */
+    pthread_mutex_lock(&(service->lock));
+    if( service->no_queues == service->capacity ) {
+        size_t capacity = service->capacity ? service->capacity * 2 : 8;
+        bsat_toq_t** heap = realloc(
+                service->heap, capacity * sizeof(bsat_toq_t*));
+        if( !heap ) {
+            pthread_mutex_unlock(&(service->lock));
+            errno = ENOMEM;
+            return -1;
+        }
+        service->heap = heap;
+        service->capacity = capacity;
+    }
+    service->no_queues++;
+    pthread_mutex_unlock(&(service->lock));
+
+    /* Only pending deadlines should keep the loop alive: */
+    ev_async_init(&(toq->service_async), bsat_service_notify);
+    toq->service_async.data = toq;
+    ev_async_start(TOQ_LOOP_ &(toq->service_async));
+    ev_unref(TOQ_LOOP);
+
+    toq->service = service;
+    toq->service_at = -1.0;
+    toq->service_idx = SERVICE_NONE;
+    toq->service_ref = 0;
+    return bsat_toq_set_scheduler(
+            toq, bsat_service_schedule, bsat_service_clock);
+}
+
+
+void bsat_service_remove(bsat_toq_t* toq)
+{
+    bsat_service_t* service = toq->service;
+    if( !service ) {
+        return;
+    }
+
+    /* This withdraws the deadline (if any) and starts the ev_timer: */
+    bsat_toq_set_scheduler(toq, NULL, NULL);
+
+    ev_ref(TOQ_LOOP);
+    ev_async_stop(TOQ_LOOP_ &(toq->service_async));
+
+    pthread_mutex_lock(&(service->lock));
+    service->no_queues--;
+    pthread_mutex_unlock(&(service->lock));
+    toq->service = NULL;
+    return;
+}
+
+
+/* The timer thread: sleep until the earliest deadline, then notify every
+ * queue which is due: */
+static void* bsat_service_run(void* arg)
+{
+    bsat_service_t* service = arg;
+    pthread_mutex_lock(&(service->lock));
+    while( service->running ) {
+        if( !service->no_pending ) {
+            service->wake_at = -1.0;
+            pthread_cond_wait(&(service->cond), &(service->lock));
+            continue;
+        }
+
+        bsat_toq_t* toq = service->heap[0];
+        ev_tstamp deadline = toq->service_at;
+        if( deadline <= ev_time() ) {
+            /* The queue's loop takes it from here (and posts its next
+             * deadline once it's done): */
+            bsat_service_unlink(service, toq);
+            toq->service_at = -1.0;
+            ev_async_send(TOQ_LOOP_ &(toq->service_async));
+            service->no_notifications++;
+            continue;
+        }
+
+        struct timespec ts;
+        ts.tv_sec = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - (ev_tstamp)ts.tv_sec) * 1e9);
+        service->wake_at = deadline;
+        pthread_cond_timedwait(&(service->cond), &(service->lock), &ts);
+        service->no_wakeups++;
+    }
+    pthread_mutex_unlock(&(service->lock));
+    return NULL;
+}
+
+
+static void bsat_service_notify(EV_P_ ev_async* w, int revents)
+{
+    bsat_toq_expire_due((bsat_toq_t*)w->data);
+    return;
+}
+
+
+/* Post the next deadline of a queue to its service (on the queue's loop): */
+static void bsat_service_schedule(bsat_toq_t* toq, ev_tstamp delay)
+{
+    bsat_service_t* service = toq->service;
+    ev_tstamp deadline = delay < 0.0 ? -1.0 : ev_now(TOQ_LOOP) + delay;
+
+    /* Like the ev_timer, keep the loop alive while something's pending: */
+    int pending = deadline >= 0.0;
+    if( pending != toq->service_ref ) {
+        if( pending ) {
+            ev_ref(TOQ_LOOP);
+        } else {
+            ev_unref(TOQ_LOOP);
+        }
+        toq->service_ref = pending;
+    }
+
+    pthread_mutex_lock(&(service->lock));
+    if( deadline == toq->service_at ) {
+        pthread_mutex_unlock(&(service->lock));
+        return;
+    }
+
+    if( toq->service_idx != SERVICE_NONE ) {
+        bsat_service_unlink(service, toq);
+    }
+
+    toq->service_at = deadline;
+    if( pending ) {
+        toq->service_idx = service->no_pending++;
+        service->heap[toq->service_idx] = toq;
+        bsat_service_sift(service, toq->service_idx);
+
+        /* Only wake the thread if it would otherwise sleep past this: */
+        if( service->wake_at < 0.0 || deadline < service->wake_at ) {
+            pthread_cond_signal(&(service->cond));
+        }
+    }
+    pthread_mutex_unlock(&(service->lock));
+    return;
+}
+
+
+static ev_tstamp bsat_service_clock(bsat_toq_t* toq)
+{
+    return ev_now(TOQ_LOOP);
+}
+
+
+static void bsat_service_swap(bsat_service_t* service, size_t i, size_t j)
+{
+    bsat_toq_t* toq = service->heap[i];
+    service->heap[i] = service->heap[j];
+    service->heap[j] = toq;
+    service->heap[i]->service_idx = i;
+    service->heap[j]->service_idx = j;
+    return;
+}
+
+
+/* Restore the heap order around a queue whose deadline has changed: */
+static void bsat_service_sift(bsat_service_t* service, size_t idx)
+{
+    bsat_toq_t** heap = service->heap;
+    while( idx > 0 ) {
+        size_t parent = (idx - 1) / 2;
+        if( heap[parent]->service_at <= heap[idx]->service_at ) {
+            break;
+        }
+        bsat_service_swap(service, idx, parent);
+        idx = parent;
+    }
+
+    for( ;; ) {
+        size_t least = idx;
+        size_t left = 2 * idx + 1;
+        size_t right = left + 1;
+        if( left < service->no_pending
+                && heap[left]->service_at < heap[least]->service_at ) {
+            least = left;
+        }
+        if( right < service->no_pending
+                && heap[right]->service_at < heap[least]->service_at ) {
+            least = right;
+        }
+        if( least == idx ) {
+            break;
+        }
+        bsat_service_swap(service, idx, least);
+        idx = least;
+    }
+    return;
+}
+
+
+static void bsat_service_unlink(bsat_service_t* service, bsat_toq_t* toq)
+{
+    size_t idx = toq->service_idx;
+    size_t last = --service->no_pending;
+    if( idx != last ) {
+        bsat_service_swap(service, idx, last);
+        bsat_service_sift(service, idx);
+    }
+    toq->service_idx = SERVICE_NONE;
+    return;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Executor Functions:
+ *--------------------------------------------------*/
+int bsat_executor_open(
+        EV_P_
+        bsat_executor_t* executor,
+        unsigned int no_threads,
+        bsat_callback_t done_cb)
+{
+    if( !no_threads ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    executor->threads = calloc(no_threads, sizeof(pthread_t));
+    if( !executor->threads ) {
+        return -1;
+    }
+
+#if EV_MULTIPLICITY
+    executor->loop = EV_A;
+#endif /* EV_MULTIPLICITY */
+    executor->no_threads = 0;
+    executor->pending = NULL;
+    executor->completed = NULL;
+    executor->done_cb = done_cb;
+    executor->in_flight = 0;
+    executor->running = 1;
+    executor->no_batches = 0;
+    executor->data = NULL;
+    sem_init(&(executor->ready), 0, 0);
+
+    /* Only batches in flight should keep the loop alive: */
+    ev_async_init(&(executor->async), bsat_executor_notify);
+    executor->async.data = executor;
+    ev_async_start(EXECUTOR_LOOP_ &(executor->async));
+    ev_unref(EXECUTOR_LOOP);
+
+    for( unsigned int i=0; i<no_threads; i++ ) {
+        int rc = pthread_create(&(executor->threads[i]), NULL,
+                bsat_executor_work, executor);
+        if( rc ) {
+            bsat_executor_close(executor);
+            errno = rc;
+            return -1;
+        }
+        executor->no_threads++;
+    }
+    return 0;
+}
+
+
+void bsat_executor_close(bsat_executor_t* executor)
+{
+    __atomic_store_n(&(executor->running), 0, __ATOMIC_RELEASE);
+    for( unsigned int i=0; i<executor->no_threads; i++ ) {
+        sem_post(&(executor->ready));
+    }
+    for( unsigned int i=0; i<executor->no_threads; i++ ) {
+        pthread_join(executor->threads[i], NULL);
+    }
+
+    /* Finish whatever the workers didn't get to, right here: */
+    bsat_batch_t* batch;
+    while( (batch = bsat_executor_take(executor)) ) {
+        bsat_executor_run(executor, batch);
+    }
+    bsat_executor_complete(executor);
+
+    ev_ref(EXECUTOR_LOOP);
+    ev_async_stop(EXECUTOR_LOOP_ &(executor->async));
+    sem_destroy(&(executor->ready));
+    free(executor->threads);
+    executor->threads = NULL;
+    executor->no_threads = 0;
+    return;
+}
+
+
+void bsat_toq_set_executor(bsat_toq_t* toq, bsat_executor_t* executor)
+{
+    /* Whatever was put together for the old executor goes to it: */
+    if( toq->batch ) {
+        bsat_toq_submit(toq);
+    }
+    toq->executor = executor;
+    return;
+}
+
+
+/* Add an expired item to the batch being put together (by dispatch, an
+ * eviction, or bsat_toq_invoke_pending): */
+static void bsat_toq_offload(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    bsat_batch_t* batch = toq->batch;
+    if( batch && batch->no_items == BSAT_BATCH_SIZE ) {
+        bsat_toq_submit(toq);
+        batch = NULL;
+    }
+
+    if( !batch ) {
+        /* If we're out of memory, it'll just have to happen here: */
+        batch = malloc(sizeof(bsat_batch_t));
+        if( !batch ) {
+            toq->cb(toq, item);
+            return;
+        }
+        batch->next = NULL;
+        batch->toq = toq;
+        batch->no_items = 0;
+        toq->batch = batch;
+    }
+
+    batch->items[batch->no_items++] = item;
+    return;
+}
+
+
+static void bsat_toq_submit(bsat_toq_t* toq)
+{
+    bsat_executor_t* executor = toq->executor;
+    bsat_batch_t* batch = toq->batch;
+    toq->batch = NULL;
+
+    /* If the executor has been closed (e.g. by a callback), there's nobody
+     * left to run the batch — so it's run here, as close would have: */
+    if( !__atomic_load_n(&(executor->running), __ATOMIC_ACQUIRE) ) {
+        for( size_t i=0; i<batch->no_items; i++ ) {
+            toq->cb(toq, batch->items[i]);
+        }
+        if( executor->done_cb ) {
+            for( size_t i=0; i<batch->no_items; i++ ) {
+                executor->done_cb(toq, batch->items[i]);
+            }
+        }
+        free(batch);
+        executor->no_batches++;
+        return;
+    }
+
+    if( executor->in_flight++ == 0 ) {
+        ev_ref(EXECUTOR_LOOP);
+    }
+    bsat_batch_push(&(executor->pending), batch, batch);
+    sem_post(&(executor->ready));
+    return;
+}
+
+
+/* A worker thread: one batch per post, until the executor is closed: */
+static void* bsat_executor_work(void* arg)
+{
+    bsat_executor_t* executor = arg;
+    for( ;; ) {
+        while( sem_wait(&(executor->ready)) && errno == EINTR ) {
+            continue;
+        }
+
+        /* Another worker may be putting back what it took along with its
+         * own batch: */
+        bsat_batch_t* batch;
+        while( !(batch = bsat_executor_take(executor)) ) {
+            if( !__atomic_load_n(&(executor->running), __ATOMIC_ACQUIRE) ) {
+                return NULL;
+            }
+            sched_yield();
+        }
+        bsat_executor_run(executor, batch);
+    }
+    return NULL;
+}
+
+
+/* Invoke the callback for every item in a batch, then pass it back: */
+static void bsat_executor_run(bsat_executor_t* executor, bsat_batch_t* batch)
+{
+    bsat_toq_t* toq = batch->toq;
+    for( size_t i=0; i<batch->no_items; i++ ) {
+        toq->cb(toq, batch->items[i]);
+    }
+
+    bsat_batch_push(&(executor->completed), batch, batch);
+    ev_async_send(EXECUTOR_LOOP_ &(executor->async));
+    return;
+}
+
+
+static void bsat_executor_notify(EV_P_ ev_async* w, int revents)
+{
+    bsat_executor_complete((bsat_executor_t*)w->data);
+    return;
+}
+
+
+/* Back on the loop: invoke done_cb for every completed item: */
+static void bsat_executor_complete(bsat_executor_t* executor)
+{
+    bsat_batch_t* batch = __atomic_exchange_n(
+            &(executor->completed), NULL, __ATOMIC_ACQUIRE);
+    while( batch ) {
+        bsat_batch_t* next = batch->next;
+        if( executor->done_cb ) {
+            for( size_t i=0; i<batch->no_items; i++ ) {
+                executor->done_cb(batch->toq, batch->items[i]);
+            }
+        }
+
+        free(batch);
+        executor->no_batches++;
+        if( --executor->in_flight == 0 ) {
+            ev_unref(EXECUTOR_LOOP);
+        }
+        batch = next;
+    }
+    return;
+}
+
+
+/* Take one batch off the pending stack. Popping a single node from a
+ * Treiber stack with several consumers is prone to ABA, so we take the
+ * whole stack and push back the rest: */
+static bsat_batch_t* bsat_executor_take(bsat_executor_t* executor)
+{
+    bsat_batch_t* batch = __atomic_exchange_n(
+            &(executor->pending), NULL, __ATOMIC_ACQUIRE);
+    if( batch && batch->next ) {
+        bsat_batch_t* last = batch->next;
+        while( last->next ) {
+            last = last->next;
+        }
+        bsat_batch_push(&(executor->pending), batch->next, last);
+    }
+
+    if( batch ) {
+        batch->next = NULL;
+    }
+    return batch;
+}
+
+
+/* Push a chain of batches onto a lock-free stack: */
+static void bsat_batch_push(
+        bsat_batch_t** stack, bsat_batch_t* first, bsat_batch_t* last)
+{
+    bsat_batch_t* head = __atomic_load_n(stack, __ATOMIC_RELAXED);
+    do {
+        last->next = head;
+    } while( !__atomic_compare_exchange_n(stack, &head, first, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+    return;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Ring Functions:
+ *--------------------------------------------------*/
+int bsat_ring_init(
+        bsat_ring_t* ring,
+        uint32_t no_owners,
+        uint32_t capacity,
+        ev_tstamp after,
+        ev_tstamp resolution,
+        ev_tstamp now,
+        bsat_ring_cb_t cb)
+{
+    if( !no_owners || capacity < no_owners || capacity > RING_MAX_TICK
+            || after <= 0.0 || resolution <= 0.0
+            || after / resolution >= RING_MAX_TICK / 2 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t size = 1;
+    while( size < capacity ) {
+        size <<= 1;
+    }
+
+    ring->ticks = malloc(size * sizeof(uint32_t));
+    ring->owners = malloc(size * sizeof(uint32_t));
+    ring->slots = malloc(no_owners * sizeof(uint32_t));
+    if( !ring->ticks || !ring->owners || !ring->slots ) {
+        bsat_ring_free(ring);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for( uint32_t i=0; i<no_owners; i++ ) {
+        ring->slots[i] = BSAT_RING_NONE;
+    }
+
+    ring->capacity = size;
+    ring->no_owners = no_owners;
+    ring->head = ring->tail = 0;
+    ring->no_items = 0;
+    ring->after_ticks = (uint32_t)(after / resolution);
+    if( ring->after_ticks * resolution < after ) {
+        ring->after_ticks++;
+    }
+    ring->epoch = now;
+    ring->resolution = resolution;
+    ring->cb = cb;
+    ring->no_compactions = 0;
+    ring->data = NULL;
+    bsat_ring_set_isa(ring, NULL);
+    return 0;
+}
+
+
+void bsat_ring_free(bsat_ring_t* ring)
+{
+    free(ring->ticks);
+    free(ring->owners);
+    free(ring->slots);
+    ring->ticks = ring->owners = ring->slots = NULL;
+    return;
+}
+
+
+int bsat_ring_set_isa(bsat_ring_t* ring, const char* isa)
+{
+    /* The best we've got, by default: */
+    static const char* isas[] = { "avx2", "sse2", "neon", "scalar" };
+    for( size_t i=0; i<sizeof(isas) / sizeof(isas[0]); i++ ) {
+        if( isa && strcmp(isa, isas[i]) ) {
+            continue;
+        }
+
+        bsat_ring_scan_t scan = bsat_ring_kernel(isas[i]);
+        if( scan ) {
+            ring->scan = scan;
+            ring->isa = isas[i];
+            return 0;
+        }
+    }
+
+    errno = ENOTSUP;
+    return -1;
+}
+
+
+int bsat_ring_start(bsat_ring_t* ring, uint32_t owner, ev_tstamp now)
+{
+    if( owner >= ring->no_owners ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t deadline = bsat_ring_tick(ring, now) + ring->after_ticks;
+    uint32_t idx = ring->slots[owner];
+    if( idx != BSAT_RING_NONE ) {
+        /* Still in the same tick, so it's still in order where it is: */
+        if( ring->ticks[idx] == deadline ) {
+            return 0;
+        }
+        bsat_ring_stop(ring, owner);
+    }
+
+    /* NOTE: there are at least as many slots as owners, so compacting
+     * always makes room: */
+    if( ring->tail - ring->head == ring->capacity ) {
+        bsat_ring_compact(ring);
+    }
+
+    idx = RING_INDEX(ring, ring->tail);
+    ring->ticks[idx] = deadline;
+    ring->owners[idx] = owner;
+    ring->slots[owner] = idx;
+    ring->tail++;
+    ring->no_items++;
+    return 0;
+}
+
+
+int bsat_ring_reset(bsat_ring_t* ring, uint32_t owner, ev_tstamp now)
+{
+    return bsat_ring_start(ring, owner, now);
+}
+
+
+void bsat_ring_stop(bsat_ring_t* ring, uint32_t owner)
+{
+    uint32_t idx = ring->slots[owner];
+    if( idx == BSAT_RING_NONE ) {
+        return;
+    }
+
+    ring->owners[idx] = BSAT_RING_TOMBSTONE;
+    ring->slots[owner] = BSAT_RING_NONE;
+    ring->no_items--;
+    return;
+}
+
+
+int bsat_ring_is_active(const bsat_ring_t* ring, uint32_t owner)
+{
+    return ring->slots[owner] != BSAT_RING_NONE;
+}
+
+
+size_t bsat_ring_expire(bsat_ring_t* ring, ev_tstamp now, size_t max)
+{
+    size_t no_expired = 0;
+    while( ring->head != ring->tail && (!max || no_expired < max) ) {
+        /* NOTE: callbacks can move the epoch up: */
+        uint32_t now_tick = bsat_ring_tick(ring, now);
+
+        /* Scan up to the end of the array, or the tail, whichever is
+         * first: */
+        uint32_t idx = RING_INDEX(ring, ring->head);
+        size_t n = ring->tail - ring->head;
+        if( n > ring->capacity - idx ) {
+            n = ring->capacity - idx;
+        }
+
+        size_t run = ring->scan(&(ring->ticks[idx]), n, now_tick);
+        if( !run ) {
+            break;
+        }
+
+        /* Callbacks can add items, which can compact the ring, which moves
+         * everything around — in which case, scan again: */
+        uint64_t compactions = ring->no_compactions;
+        for( size_t i=0; i<run; i++ ) {
+            uint32_t owner = ring->owners[idx + i];
+            ring->head++;
+            if( owner == BSAT_RING_TOMBSTONE ) {
+                continue;
+            }
+
+            ring->slots[owner] = BSAT_RING_NONE;
+            ring->no_items--;
+            ring->cb(ring, owner);
+            no_expired++;
+            if( (max && no_expired == max)
+                    || ring->no_compactions != compactions ) {
+                break;
+            }
+        }
+    }
+    return no_expired;
+}
+
+
+ev_tstamp bsat_ring_next_deadline(bsat_ring_t* ring)
+{
+    while( ring->head != ring->tail
+            && ring->owners[RING_INDEX(ring, ring->head)]
+                == BSAT_RING_TOMBSTONE ) {
+        ring->head++;
+    }
+
+    if( ring->head == ring->tail ) {
+        return -1.0;
+    }
+    return ring->epoch
+        + ring->ticks[RING_INDEX(ring, ring->head)] * ring->resolution;
+}
+
+
+/* The current tick — moving the epoch up first, if need be: */
+static uint32_t bsat_ring_tick(bsat_ring_t* ring, ev_tstamp now)
+{
+    ev_tstamp ticks = (now - ring->epoch) / ring->resolution;
+    if( ticks < 0.0 ) {
+        return 0;
+    }
+    if( ticks + ring->after_ticks < RING_MAX_TICK ) {
+        return (uint32_t)ticks;
+    }
+
+    /* The oldest slot has the smallest tick, since they're in order: */
+    uint32_t shift = (uint32_t)ticks;
+    if( ring->head != ring->tail ) {
+        shift = ring->ticks[RING_INDEX(ring, ring->head)];
+    }
+    for( uint32_t pos=ring->head; pos != ring->tail; pos++ ) {
+        ring->ticks[RING_INDEX(ring, pos)] -= shift;
+    }
+    ring->epoch += shift * ring->resolution;
+    return (uint32_t)((now - ring->epoch) / ring->resolution);
+}
+
+
+/* Squeeze out the tombstones, keeping the live slots in order: */
+static void bsat_ring_compact(bsat_ring_t* ring)
+{
+    uint32_t write = ring->head;
+    for( uint32_t pos=ring->head; pos != ring->tail; pos++ ) {
+        uint32_t idx = RING_INDEX(ring, pos);
+        uint32_t owner = ring->owners[idx];
+        if( owner == BSAT_RING_TOMBSTONE ) {
+            continue;
+        }
+
+        uint32_t dest = RING_INDEX(ring, write++);
+        if( dest != idx ) {
+            ring->ticks[dest] = ring->ticks[idx];
+            ring->owners[dest] = owner;
+            ring->slots[owner] = dest;
+        }
+    }
+    ring->tail = write;
+    ring->no_compactions++;
+    return;
+}
+
+
+static size_t bsat_ring_scan_scalar(
+        const uint32_t* ticks, size_t n, uint32_t now)
+{
+    size_t i = 0;
+    while( i < n && ticks[i] <= now ) {
+        i++;
+    }
+    return i;
+}
+
+
+/* NOTE: ticks are below RING_MAX_TICK, so signed compares are fine: */
+#ifdef RING_X86
+__attribute__((target("avx2")))
+static size_t bsat_ring_scan_avx2(
+        const uint32_t* ticks, size_t n, uint32_t now)
+{
+    __m256i limit = _mm256_set1_epi32((int32_t)now);
+    size_t i = 0;
+    for( ; i + 8 <= n; i += 8 ) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(ticks + i));
+        int later = _mm256_movemask_ps(
+                _mm256_castsi256_ps(_mm256_cmpgt_epi32(v, limit)));
+        if( later ) {
+            return i + (size_t)__builtin_ctz((unsigned int)later);
+        }
+    }
+    return i + bsat_ring_scan_scalar(ticks + i, n - i, now);
+}
+
+
+__attribute__((target("sse2")))
+static size_t bsat_ring_scan_sse2(
+        const uint32_t* ticks, size_t n, uint32_t now)
+{
+    __m128i limit = _mm_set1_epi32((int32_t)now);
+    size_t i = 0;
+    for( ; i + 4 <= n; i += 4 ) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(ticks + i));
+        int later = _mm_movemask_ps(
+                _mm_castsi128_ps(_mm_cmpgt_epi32(v, limit)));
+        if( later ) {
+            return i + (size_t)__builtin_ctz((unsigned int)later);
+        }
+    }
+    return i + bsat_ring_scan_scalar(ticks + i, n - i, now);
+}
+#endif /* RING_X86 */
+
+
+#ifdef RING_NEON
+static size_t bsat_ring_scan_neon(
+        const uint32_t* ticks, size_t n, uint32_t now)
+{
+    uint32x4_t limit = vdupq_n_u32(now);
+    size_t i = 0;
+    for( ; i + 4 <= n; i += 4 ) {
+        uint32x4_t later = vcgtq_u32(vld1q_u32(ticks + i), limit);
+        if( vmaxvq_u32(later) ) {
+            break;
+        }
+    }
+    return i + bsat_ring_scan_scalar(ticks + i, n - i, now);
+}
+#endif /* RING_NEON */
+
+
+/* The scan kernel for an instruction set, if this build and CPU have it: */
+static bsat_ring_scan_t bsat_ring_kernel(const char* isa)
+{
+#ifdef RING_X86
+    __builtin_cpu_init();
+    if( !strcmp(isa, "avx2") && __builtin_cpu_supports("avx2") ) {
+        return bsat_ring_scan_avx2;
+    }
+    if( !strcmp(isa, "sse2") && __builtin_cpu_supports("sse2") ) {
+        return bsat_ring_scan_sse2;
+    }
+#endif /* RING_X86 */
+
+#ifdef RING_NEON
+    if( !strcmp(isa, "neon") ) {
+        return bsat_ring_scan_neon;
+    }
+#endif /* RING_NEON */
+
+    if( !strcmp(isa, "scalar") ) {
+        return bsat_ring_scan_scalar;
+    }
+    return NULL;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Shared Memory Functions:
+ *--------------------------------------------------*/
+int bsat_shm_open(
+        bsat_shm_t* shm,
+        const char* path,
+        unsigned int no_workers,
+        uint32_t no_slots)
+{
+    if( !no_workers || !no_slots || no_slots == BSAT_SHM_NIL
+            || no_workers > UINT32_MAX / no_slots ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = SHM_LISTS_OFFSET
+        + no_workers * sizeof(bsat_shm_list_t)
+        + (size_t)no_workers * no_slots * sizeof(bsat_shm_slot_t);
+
+    int fd = -1;
+    if( path ) {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if( fd < 0 ) {
+            return -1;
+        }
+
+        if( ftruncate(fd, (off_t)size) ) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+
+    if( bsat_shm_map(shm, fd, size) ) {
+        return -1;
+    }
+
+    bsat_shm_header_t* header = shm->header;
+    memcpy(header->magic, BSAT_SHM_MAGIC, sizeof(header->magic));
+    header->version = BSAT_SHM_VERSION;
+    header->no_workers = no_workers;
+    header->no_slots = no_slots;
+    header->reserved = 0;
+    shm->lists = (bsat_shm_list_t*)((char*)header + SHM_LISTS_OFFSET);
+    shm->slots = (bsat_shm_slot_t*)(shm->lists + no_workers);
+
+    /* Every slot starts out on its worker's free list: */
+    for( unsigned int w=0; w<no_workers; w++ ) {
+        bsat_shm_list_t* list = &(shm->lists[w]);
+        memset(list, 0, sizeof(*list));
+        list->head = list->tail = BSAT_SHM_NIL;
+        list->free = 0;
+
+        bsat_shm_slot_t* slots = SHM_SLOTS(shm, w);
+        for( uint32_t i=0; i<no_slots; i++ ) {
+            slots[i].prev = BSAT_SHM_NIL;
+            slots[i].next = i + 1 < no_slots ? i + 1 : BSAT_SHM_NIL;
+            slots[i].id = 0;
+            slots[i].tstamp = 0.0;
+        }
+    }
+    return 0;
+}
+
+
+int bsat_shm_attach(bsat_shm_t* shm, const char* path)
+{
+    int fd = open(path, O_RDWR);
+    if( fd < 0 ) {
+        return -1;
+    }
+
+    struct stat st;
+    if( fstat(fd, &st) ) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if( (size_t)st.st_size < SHM_LISTS_OFFSET ) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( bsat_shm_map(shm, fd, (size_t)st.st_size) ) {
+        return -1;
+    }
+
+    /* Make sure it's what we think it is, and that it all fits: */
+    bsat_shm_header_t* header = shm->header;
+    size_t no_workers = header->no_workers;
+    if( memcmp(header->magic, BSAT_SHM_MAGIC, sizeof(header->magic))
+            || header->version != BSAT_SHM_VERSION
+            || shm->size < SHM_LISTS_OFFSET
+                + no_workers * sizeof(bsat_shm_list_t)
+                + no_workers * header->no_slots * sizeof(bsat_shm_slot_t) ) {
+        bsat_shm_close(shm);
+        errno = EINVAL;
+        return -1;
+    }
+
+    shm->lists = (bsat_shm_list_t*)((char*)header + SHM_LISTS_OFFSET);
+    shm->slots = (bsat_shm_slot_t*)(shm->lists + no_workers);
+    return 0;
+}
+
+
+void bsat_shm_close(bsat_shm_t* shm)
+{
+    if( !shm->header ) {
+        return;
+    }
+
+    munmap(shm->header, shm->size);
+    shm->header = NULL;
+    shm->lists = NULL;
+    shm->slots = NULL;
+    shm->size = 0;
+    return;
+}
+
+
+int bsat_shm_start(
+        bsat_shm_t* shm,
+        unsigned int worker,
+        uint64_t id,
+        ev_tstamp now,
+        uint32_t* slot)
+{
+    if( worker >= shm->header->no_workers ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bsat_shm_list_t* list = &(shm->lists[worker]);
+    bsat_shm_slot_t* slots = SHM_SLOTS(shm, worker);
+    uint32_t idx = list->free;
+    if( idx == BSAT_SHM_NIL ) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    bsat_shm_write_begin(list);
+    list->free = slots[idx].next;
+    SHM_STORE(slots[idx].id, id);
+    bsat_shm_link(list, slots, idx, now);
+    SHM_STORE(list->no_items, list->no_items + 1);
+    bsat_shm_write_end(list);
+
+    *slot = idx;
+    return 0;
+}
+
+
+void bsat_shm_reset(
+        bsat_shm_t* shm,
+        unsigned int worker,
+        uint32_t slot,
+        ev_tstamp now)
+{
+    bsat_shm_list_t* list = &(shm->lists[worker]);
+    bsat_shm_slot_t* slots = SHM_SLOTS(shm, worker);
+    bsat_shm_write_begin(list);
+    bsat_shm_unlink(list, slots, slot);
+    bsat_shm_link(list, slots, slot, now);
+    bsat_shm_write_end(list);
+    return;
+}
+
+
+void bsat_shm_stop(bsat_shm_t* shm, unsigned int worker, uint32_t slot)
+{
+    bsat_shm_list_t* list = &(shm->lists[worker]);
+    bsat_shm_slot_t* slots = SHM_SLOTS(shm, worker);
+    bsat_shm_write_begin(list);
+    bsat_shm_unlink(list, slots, slot);
+    SHM_STORE(slots[slot].next, list->free);
+    list->free = slot;
+    SHM_STORE(list->no_items, list->no_items - 1);
+    bsat_shm_write_end(list);
+    return;
+}
+
+
+size_t bsat_shm_scan_idle(
+        const bsat_shm_t* shm,
+        ev_tstamp before,
+        bsat_shm_item_t* out,
+        size_t max,
+        unsigned int* no_skipped)
+{
+    if( no_skipped ) {
+        *no_skipped = 0;
+    }
+    if( !max ) {
+        return 0;
+    }
+
+    /* Each worker's list is already in order, so this is a merge: */
+    bsat_shm_item_t* found = malloc(2 * max * sizeof(bsat_shm_item_t));
+    if( !found ) {
+        return 0;
+    }
+    bsat_shm_item_t* merged = found + max;
+
+    size_t no_out = 0;
+    for( unsigned int w=0; w<shm->header->no_workers; w++ ) {
+        size_t no_found = bsat_shm_read_list(shm, w, before, found, max);
+        if( no_found == SHM_BUSY ) {
+            if( no_skipped ) {
+                (*no_skipped)++;
+            }
+            continue;
+        }
+
+        size_t i = 0;
+        size_t j = 0;
+        size_t k = 0;
+        while( k < max && (i < no_out || j < no_found) ) {
+            if( j == no_found
+                    || (i < no_out && out[i].tstamp <= found[j].tstamp) ) {
+                merged[k++] = out[i++];
+            } else {
+                merged[k++] = found[j++];
+            }
+        }
+        memcpy(out, merged, k * sizeof(bsat_shm_item_t));
+        no_out = k;
+
+        /* Nothing later in the next lists can make the cut: */
+        if( no_out == max ) {
+            before = out[max - 1].tstamp;
+        }
+    }
+
+    free(found);
+    return no_out;
+}
+
+
+static int bsat_shm_map(bsat_shm_t* shm, int fd, size_t size)
+{
+    int flags = fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+    void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if( fd >= 0 ) {
+        close(fd);
+    }
+    if( region == MAP_FAILED ) {
+        return -1;
+    }
+
+    shm->header = region;
+    shm->size = size;
+    shm->data = NULL;
+    return 0;
+}
+
+
+/* Readers ignore whatever they read while seq is odd: */
+static void bsat_shm_write_begin(bsat_shm_list_t* list)
+{
+    SHM_STORE(list->seq, list->seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return;
+}
+
+
+static void bsat_shm_write_end(bsat_shm_list_t* list)
+{
+    __atomic_store_n(&(list->seq), list->seq + 1, __ATOMIC_RELEASE);
+    return;
+}
+
+
+static void bsat_shm_link(
+        bsat_shm_list_t* list,
+        bsat_shm_slot_t* slots,
+        uint32_t idx,
+        ev_tstamp now)
+{
+    __atomic_store(&(slots[idx].tstamp), &now, __ATOMIC_RELAXED);
+    slots[idx].prev = list->tail;
+    SHM_STORE(slots[idx].next, BSAT_SHM_NIL);
+    if( list->tail == BSAT_SHM_NIL ) {
+        SHM_STORE(list->head, idx);
+    } else {
+        SHM_STORE(slots[list->tail].next, idx);
+    }
+    SHM_STORE(list->tail, idx);
+    return;
+}
+
+
+static void bsat_shm_unlink(
+        bsat_shm_list_t* list, bsat_shm_slot_t* slots, uint32_t idx)
+{
+    uint32_t prev = slots[idx].prev;
+    uint32_t next = slots[idx].next;
+    if( prev == BSAT_SHM_NIL ) {
+        SHM_STORE(list->head, next);
+    } else {
+        SHM_STORE(slots[prev].next, next);
+    }
+    if( next == BSAT_SHM_NIL ) {
+        SHM_STORE(list->tail, prev);
+    } else {
+        slots[next].prev = prev;
+    }
+    return;
+}
+
+
+/* Read the first (up to) max items idle since before from a worker's list,
+ * retrying if the worker changes it while we're at it. Returns SHM_BUSY if
+ * the list never held still (e.g. the worker died in the middle of a write):
+ */
+static size_t bsat_shm_read_list(
+        const bsat_shm_t* shm,
+        unsigned int worker,
+        ev_tstamp before,
+        bsat_shm_item_t* out,
+        size_t max)
+{
+    bsat_shm_list_t* list = &(shm->lists[worker]);
+    bsat_shm_slot_t* slots = SHM_SLOTS(shm, worker);
+    uint32_t no_slots = shm->header->no_slots;
+    for( int tries=0; tries<SHM_RETRIES; tries++ ) {
+        uint32_t seq = __atomic_load_n(&(list->seq), __ATOMIC_ACQUIRE);
+        if( seq & 1 ) {
+            sched_yield();
+            continue;
+        }
+
+        /* NOTE: a torn read can follow any link, so bound everything: */
+        size_t no_read = 0;
+        uint32_t idx = SHM_LOAD(list->head);
+        while( no_read < max && idx < no_slots ) {
+            ev_tstamp tstamp;
+            __atomic_load(&(slots[idx].tstamp), &tstamp, __ATOMIC_RELAXED);
+            if( tstamp > before ) {
+                break;
+            }
+
+            out[no_read].id = SHM_LOAD(slots[idx].id);
+            out[no_read].tstamp = tstamp;
+            out[no_read].worker = worker;
+            out[no_read].slot = idx;
+            no_read++;
+            idx = SHM_LOAD(slots[idx].next);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if( SHM_LOAD(list->seq) == seq ) {
+            return no_read;
+        }
+    }
+    return SHM_BUSY;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Pool Functions:
+ *--------------------------------------------------*/
+int bsat_pool_open(
+        bsat_pool_t* pool, size_t item_size, size_t capacity, int flags)
+{
+    if( !item_size || !capacity ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Freed items hold the free list, so they're at least a pointer: */
+    if( item_size < sizeof(void*) ) {
+        item_size = sizeof(void*);
+    }
+    item_size = (item_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    if( capacity > (SIZE_MAX - 2 * POOL_HUGE_PAGE) / item_size ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int huge = flags & (BSAT_POOL_HUGETLB | BSAT_POOL_THP);
+    size_t size = item_size * capacity;
+    if( huge ) {
+        size = (size + POOL_HUGE_PAGE - 1) & ~(POOL_HUGE_PAGE - 1);
+    }
+
+    int backing = 0;
+    char* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if( flags & BSAT_POOL_HUGETLB ) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if( base != MAP_FAILED ) {
+            backing |= BSAT_POOL_HUGETLB;
+        }
+    }
+#endif /* MAP_HUGETLB */
+
+    /* No huge pages reserved (or none asked for): */
+    if( base == MAP_FAILED ) {
+        base = bsat_pool_map(size, huge ? POOL_HUGE_PAGE : 0);
+        if( base == MAP_FAILED ) {
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        if( huge && !madvise(base, size, MADV_HUGEPAGE) ) {
+            backing |= BSAT_POOL_THP;
+        }
+#endif /* MADV_HUGEPAGE */
+    }
+
+    pool->node = -1;
+    if( flags & BSAT_POOL_NUMA_LOCAL ) {
+        pool->node = bsat_pool_bind(base, size);
+        if( pool->node >= 0 ) {
+            backing |= BSAT_POOL_NUMA_LOCAL;
+        }
+    }
+
+    pool->base = base;
+    pool->size = size;
+    pool->item_size = item_size;
+    pool->capacity = capacity;
+    pool->no_used = 0;
+    pool->no_items = 0;
+    pool->free_list = NULL;
+    pool->backing = backing;
+    pool->data = NULL;
+    return 0;
+}
+
+
+void bsat_pool_close(bsat_pool_t* pool)
+{
+    if( pool->base ) {
+        munmap(pool->base, pool->size);
+        pool->base = NULL;
+    }
+    pool->free_list = NULL;
+    pool->no_used = pool->no_items = 0;
+    return;
+}
+
+
+void* bsat_pool_alloc(bsat_pool_t* pool)
+{
+    void* item = pool->free_list;
+    if( item ) {
+        pool->free_list = *(void**)item;
+    } else if( pool->no_used < pool->capacity ) {
+        /* Fresh items come straight from the mapping, so they're zeroed
+         * (and only faulted in as they're handed out): */
+        item = pool->base + pool->no_used++ * pool->item_size;
+    } else {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->no_items++;
+    return item;
+}
+
+
+void bsat_pool_free(bsat_pool_t* pool, void* item)
+{
+    if( !item ) {
+        return;
+    }
+
+    *(void**)item = pool->free_list;
+    pool->free_list = item;
+    pool->no_items--;
+    return;
+}
+
+
+/* Map size bytes starting on a multiple of align (if not 0), so that the
+ * region can be backed by whole huge pages: */
+static char* bsat_pool_map(size_t size, size_t align)
+{
+    size_t len = size + align;
+    char* region = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( region == MAP_FAILED || !align ) {
+        return region;
+    }
+
+    /* Trim whatever hangs over either end: */
+    size_t lead = (align - (uintptr_t)region % align) % align;
+    if( lead ) {
+        munmap(region, lead);
+    }
+    if( len - lead > size ) {
+        munmap(region + lead + size, len - lead - size);
+    }
+    return region + lead;
+}
+
+
+/* Prefer the NUMA node of the calling thread for a region which hasn't been
+ * touched yet. Returns the node, or -1 if the kernel wouldn't have it: */
+static int bsat_pool_bind(char* base, size_t size)
+{
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(SYS_mbind) \
+        && defined(SYS_getcpu)
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if( syscall(SYS_getcpu, &cpu, &node, NULL) || node >= POOL_MAX_NODES ) {
+        return -1;
+    }
+
+    unsigned long mask[POOL_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    if( syscall(SYS_mbind, base, size, MPOL_PREFERRED, mask,
+                (unsigned long)(8 * sizeof(mask)), 0) ) {
+        return -1;
+    }
+    return (int)node;
+#else
+    return -1;
+#endif /* HAVE_LINUX_MEMPOLICY_H */
+}
+
+
+/*--------------------------------------------------
+ * BSAT Timeout Functions:
+ *--------------------------------------------------*/
+void bsat_timeout_init(bsat_timeout_t* timeout)
+{
+    timeout->tstamp = (ev_tstamp)-1.0;
+    timeout->active = 0;
+    timeout->prev = timeout->next = NULL;
+    timeout->data = NULL;
+    timeout->stage = 0;
+    timeout->cls = 0;
+    timeout->group = NULL;
+}
+
+
+void bsat_timeout_start(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    /* Don't do anything if it's already started — or if its timeout is its
+     * group's: */
+    if( item->active || (item->group && !IS_GROUP_NODE(item)) ) {
+        return;
+    }
+
+    ev_tstamp now = TOQ_NOW(toq);
+    BSAT_TRACE(toq, item, BSAT_TRACE_START, now);
+    item->stage = 0;
+    bsat_toq_link(bsat_toq_route(toq, item), item, now);
+    return;
+}
+
+
+size_t bsat_timeout_start_batch(
+        bsat_toq_t* toq, bsat_timeout_t* const* items, size_t n)
+{
+    ev_tstamp now = TOQ_NOW(toq);
+    size_t no_started = 0;
+    int reschedule = 0;
+
+    for( size_t i=0; i<n; i++ ) {
+        bsat_timeout_t* item = items[i];
+        if( item->active || (item->group && !IS_GROUP_NODE(item)) ) {
+            continue;
+        }
+
+        BSAT_TRACE(toq, item, BSAT_TRACE_START, now);
+        item->stage = 0;
+        reschedule |= bsat_toq_append(bsat_toq_route(toq, item), item, now);
+        no_started++;
+    }
+
+    if( reschedule ) {
+        bsat_toq_schedule_next(toq);
+    }
+    return no_started;
+}
+
+
+void bsat_timeout_reset(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    /* Deadlines don't move, and grouped items go with their group: */
+    if( (toq->deadline_mode && item->active)
+            || (item->group && !IS_GROUP_NODE(item)) ) {
+        return;
+    }
+
+    ev_tstamp now = TOQ_NOW(toq);
+    BSAT_TRACE(toq, item, BSAT_TRACE_RESET, now);
+
+    /* Not worth a relink if it was (re)started recently enough: */
+    if( item->active && now - item->tstamp < toq->resolution
+            && !item->stage ) {
+        toq->no_skipped_resets++;
+        return;
+    }
+
+    if( item->active ) {
+        bsat_toq_unlink(bsat_toq_route(toq, item), item);
+    }
+    item->stage = 0;
+    bsat_toq_link(bsat_toq_route(toq, item), item, now);
+    return;
+}
+
+
+void bsat_timeout_stop(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( !item->active ) {
+        return;
+    }
+
+    BSAT_TRACE(toq, item, BSAT_TRACE_STOP, TOQ_NOW(toq));
+    bsat_toq_unlink(bsat_toq_route(toq, item), item);
+    return;
+}
+
+
+size_t bsat_timeout_stop_batch(
+        bsat_toq_t* toq, bsat_timeout_t* const* items, size_t n)
+{
+    ev_tstamp now = TOQ_NOW(toq);
+    size_t no_stopped = 0;
+
+    for( size_t i=0; i<n; i++ ) {
+        bsat_timeout_t* item = items[i];
+        if( !item->active ) {
+            continue;
+        }
+
+        BSAT_TRACE(toq, item, BSAT_TRACE_STOP, now);
+        bsat_toq_unlink(bsat_toq_route(toq, item), item);
+        no_stopped++;
+    }
+    return no_stopped;
+}
+
+
+void bsat_timeout_move(
+        bsat_toq_t* toq, bsat_timeout_t* dst, bsat_timeout_t* src)
+{
+    if( dst == src ) {
+        return;
+    }
+
+    bsat_timeout_stop(toq, dst);
+    if( !src->active ) {
+        return;
+    }
+
+    bsat_toq_t* lane = bsat_toq_route(toq, src);
+    dst->stage = src->stage;
+    dst->cls = src->cls;
+    bsat_toq_t* dst_lane = bsat_toq_route(toq, dst);
+
+    /* If both map to the same lane, dst simply takes src's place: */
+    if( lane == dst_lane ) {
+        dst->prev = src->prev;
+        dst->next = src->next;
+        dst->tstamp = src->tstamp;
+        dst->active = 1;
+
+        if( dst->prev ) {
+            dst->prev->next = dst;
+        } else {
+            lane->head = dst;
+        }
+
+        if( dst->next ) {
+            dst->next->prev = dst;
+        } else {
+            lane->tail = dst;
+        }
+
+        src->prev = src->next = NULL;
+        src->tstamp = (ev_tstamp)-1.0;
+        src->active = 0;
+        if( toq->cursor == src ) {
+            toq->cursor = NULL;
+        }
+        return;
+    }
+
+    /* Otherwise, append it — without moving the deadline forward or putting
+     * the lane out of order: */
+    ev_tstamp tstamp = src->tstamp;
+    bsat_toq_unlink(lane, src);
+    if( dst_lane->tail && dst_lane->tail->tstamp > tstamp ) {
+        tstamp = dst_lane->tail->tstamp;
+    }
+    bsat_toq_link(dst_lane, dst, tstamp);
+    return;
+}
+
+
+int bsat_timeout_set_class(
+        bsat_toq_t* toq, bsat_timeout_t* item, unsigned int cls)
+{
+    if( toq->lane_mode != LANES_CLASSES || cls >= toq->no_lanes ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( item->cls == cls ) {
+        return 0;
+    }
+
+    int active = item->active;
+    if( active ) {
+        bsat_timeout_stop(toq, item);
+    }
+
+    item->cls = cls;
+    if( active ) {
+        bsat_timeout_start(toq, item);
+    }
+    return 0;
+}
+
+
+int bsat_timeout_is_active(bsat_timeout_t* item)
+{
+    return item->active;
+}
+
+
+ev_tstamp bsat_timeout_deadline(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( !item->active ) {
+        return -1.0;
+    }
+    return item->tstamp + bsat_toq_route(toq, item)->after;
+}
+
+
+/*--------------------------------------------------
+ * BSAT Timeout Group Functions:
+ *--------------------------------------------------*/
+void bsat_timeout_group_init(bsat_timeout_group_t* group)
+{
+    bsat_timeout_init(&group->node);
+    group->node.group = group;
+    group->head = group->tail = NULL;
+    group->expiring = NULL;
+    group->no_items = 0;
+    group->data = NULL;
+}
+
+
+int bsat_timeout_group_add(bsat_timeout_group_t* group, bsat_timeout_t* item)
+{
+    if( item->active || item->group ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    item->group = group;
+    item->next = NULL;
+    item->prev = group->tail;
+    if( group->tail ) {
+        group->tail->next = item;
+    } else {
+        group->head = item;
+    }
+    group->tail = item;
+    group->no_items++;
+    return 0;
+}
+
+
+void bsat_timeout_group_remove(
+        bsat_timeout_group_t* group, bsat_timeout_t* item)
+{
+    if( item->group != group || item == &group->node ) {
+        return;
+    }
+
+    bsat_timeout_t* next = item->next;
+    bsat_timeout_t* prev = item->prev;
+    if( prev ) {
+        prev->next = next;
+    }
+    if( next ) {
+        next->prev = prev;
+    }
+
+    /* It's either waiting in the group, or about to be expired: */
+    if( group->head == item ) {
+        group->head = next;
+    }
+    if( group->tail == item ) {
+        group->tail = prev;
+    }
+    if( group->expiring == item ) {
+        group->expiring = next;
+    }
+
+    item->next = item->prev = NULL;
+    item->group = NULL;
+    group->no_items--;
+    return;
+}
+
+
+void bsat_timeout_group_start(bsat_toq_t* toq, bsat_timeout_group_t* group)
+{
+    bsat_timeout_start(toq, &group->node);
+}
+
+
+void bsat_timeout_group_reset(bsat_toq_t* toq, bsat_timeout_group_t* group)
+{
+    bsat_timeout_reset(toq, &group->node);
+}
+
+
+void bsat_timeout_group_stop(bsat_toq_t* toq, bsat_timeout_group_t* group)
+{
+    bsat_timeout_stop(toq, &group->node);
+}
@@ -0,0 +1,137 @@
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_ADAPTIVE_ITEMS 20
+/* Long enough that nothing's due before the loop runs, even when starting
+ * the items takes a while (e.g. under a parallel make check): */
+#define ADAPTIVE_AFTER 0.2
+#define ADAPTIVE_SLACK 0.05
+
+static bsat_timeout_t timeouts[NO_ADAPTIVE_ITEMS];
+static ev_tstamp deadlines[NO_ADAPTIVE_ITEMS];
+static ev_tstamp max_lateness = 0.0;
+static size_t no_adaptive_expired = 0;
+static ev_idle spinner;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void adaptive_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(item - timeouts);
+    ev_tstamp lateness = ev_now(toq->loop) - deadlines[idx];
+    if( lateness > max_lateness ) {
+        max_lateness = lateness;
+    }
+
+    if( ++no_adaptive_expired == NO_ADAPTIVE_ITEMS ) {
+        ev_idle_stop(toq->loop, &spinner);
+    }
+}
+
+
+/* Does nothing — but keeps the loop from blocking, like a busy server: */
+static void spin_cb(EV_P_ ev_idle* w, int revents)
+{
+    return;
+}
+
+
+/* Start the items 2ms apart, then run a busy loop until they've expired: */
+static uint64_t run_busy(EV_P_ bsat_toq_t* toq)
+{
+    no_adaptive_expired = 0;
+    max_lateness = 0.0;
+    for( size_t i=0; i<NO_ADAPTIVE_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(toq, &timeouts[i]);
+        deadlines[i] = timeouts[i].tstamp + ADAPTIVE_AFTER;
+        ev_sleep(0.002);
+        ev_now_update(EV_A);
+    }
+
+    uint64_t arms_before = toq->no_timer_arms;
+    ev_idle_init(&spinner, spin_cb);
+    ev_idle_start(EV_A_ &spinner);
+    ev_run(EV_A_ 0);
+    ymo_assert(no_adaptive_expired == NO_ADAPTIVE_ITEMS);
+    return toq->no_timer_arms - arms_before;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_adaptive_busy(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, adaptive_cb, ADAPTIVE_AFTER);
+
+    /* By default, the timer is re-armed for each expiry: */
+    uint64_t precise_arms = run_busy(EV_A_ &toq);
+    ymo_assert(precise_arms >= NO_ADAPTIVE_ITEMS / 4);
+
+    /* In adaptive mode, the busy loop does the work of the timer — on time,
+     * even though the timer would go off up to slack late: */
+    bsat_toq_set_adaptive(&toq, ADAPTIVE_SLACK);
+    uint64_t adaptive_arms = run_busy(EV_A_ &toq);
+    ymo_assert(adaptive_arms <= 2);
+    ymo_assert(max_lateness < ADAPTIVE_SLACK / 2);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    bsat_toq_set_adaptive(&toq, 0.0);
+    ymo_assert(!ev_is_active(&toq.check));
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_adaptive_idle(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, adaptive_cb, ADAPTIVE_AFTER);
+    bsat_toq_set_adaptive(&toq, 0.01);
+
+    /* With nothing else going on, the timer goes off within slack — and
+     * the check watcher doesn't keep the loop running afterwards: */
+    no_adaptive_expired = NO_ADAPTIVE_ITEMS - 1;
+    max_lateness = 0.0;
+    size_t idx = NO_ADAPTIVE_ITEMS - 1;
+    bsat_timeout_init(&timeouts[idx]);
+    bsat_timeout_start(&toq, &timeouts[idx]);
+    deadlines[idx] = timeouts[idx].tstamp + ADAPTIVE_AFTER;
+    ymo_assert(ev_is_active(&toq.check));
+
+    ev_run(loop, 0);
+    ymo_assert(no_adaptive_expired == NO_ADAPTIVE_ITEMS);
+    ymo_assert(max_lateness >= 0.0);
+    ymo_assert(max_lateness < 0.01 + ADAPTIVE_AFTER);
+
+    /* Stopping the queue stops the check watcher, too: */
+    bsat_timeout_start(&toq, &timeouts[idx]);
+    bsat_toq_stop(&toq);
+    ymo_assert(!ev_is_active(&toq.check));
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_adaptive_busy();
+    test_bsat_adaptive_idle();
+    return 0;
+}
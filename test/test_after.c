@@ -0,0 +1,157 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_AFTER_TIMEOUTS 10
+#define DRAIN_BUDGET 3
+
+static size_t no_expired = 0;
+static size_t no_storms = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void after_item_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    no_expired++;
+}
+
+
+static void after_storm_cb(bsat_toq_t* toq, size_t backlog)
+{
+    no_storms++;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_set_after_config(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, after_item_cb, 1.0);
+
+    ymo_assert(bsat_toq_set_after(&toq, 0.0, 0) == -1);
+    ymo_assert(errno == EINVAL);
+
+    /* Jitter lanes move together, and can't be pushed below zero: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.1, 3) == 0);
+    ymo_assert(bsat_toq_set_after(&toq, 0.1, 0) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_after(&toq, 2.0, 0) == 0);
+    ymo_assert(toq.after == 2.0);
+    ymo_assert(toq.lanes[0].after > 1.89 && toq.lanes[0].after < 1.91);
+    ymo_assert(toq.lanes[1].after > 1.99 && toq.lanes[1].after < 2.01);
+    ymo_assert(toq.lanes[2].after > 2.09 && toq.lanes[2].after < 2.11);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.0, 0) == 0);
+
+    /* Only the first stage changes: */
+    ev_tstamp stages[] = { 1.0, 0.5 };
+    ymo_assert(bsat_toq_set_stages(&toq, stages, 2) == 0);
+    ymo_assert(bsat_toq_set_after(&toq, 3.0, 0) == 0);
+    ymo_assert(toq.lanes[0].after == 3.0);
+    ymo_assert(toq.lanes[1].after == 0.5);
+    ymo_assert(bsat_toq_set_stages(&toq, NULL, 0) == 0);
+
+    ymo_assert(bsat_toq_set_classes(&toq, stages, 2) == 0);
+    ymo_assert(bsat_toq_set_after(&toq, 1.0, 0) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_classes(&toq, NULL, 0) == 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_set_after_live(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, after_item_cb, 0.05);
+
+    bsat_timeout_t timeouts[NO_AFTER_TIMEOUTS];
+    for( size_t i=0; i<NO_AFTER_TIMEOUTS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    /* Growing the timeout pushes the timer out right away: */
+    ymo_assert(bsat_toq_set_after(&toq, 60.0, 0) == 0);
+    ymo_assert(ev_timer_remaining(loop, &toq.timer) > 59.0);
+
+    /* Shrinking it — the timer fires on the next iteration: */
+    ev_sleep(0.02);
+    ev_now_update(loop);
+    ymo_assert(bsat_toq_set_after(&toq, 0.01, 0) == 0);
+    ymo_assert(ev_timer_remaining(loop, &toq.timer) <= 0.0);
+    ev_run(loop, EVRUN_ONCE);
+    ymo_assert(no_expired == NO_AFTER_TIMEOUTS);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_set_after_drain(void)
+{
+    EV_P = ev_default_loop(0);
+    no_expired = no_storms = 0;
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, after_item_cb, 60.0);
+    bsat_toq_set_storm(&toq, after_storm_cb, 4.0, 1);
+
+    bsat_timeout_t timeouts[NO_AFTER_TIMEOUTS];
+    for( size_t i=0; i<NO_AFTER_TIMEOUTS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    /* The whole fleet is overdue at once — expire it a few at a time: */
+    ev_sleep(0.02);
+    ev_now_update(loop);
+    ymo_assert(bsat_toq_set_after(&toq, 0.01, DRAIN_BUDGET) == 0);
+    ymo_assert(toq.drain == DRAIN_BUDGET);
+
+    size_t expected = 0;
+    while( expected < NO_AFTER_TIMEOUTS ) {
+        ev_run(loop, EVRUN_ONCE);
+        expected += DRAIN_BUDGET;
+        if( expected > NO_AFTER_TIMEOUTS ) {
+            expected = NO_AFTER_TIMEOUTS;
+        }
+        ymo_assert(no_expired == expected);
+    }
+
+    /* ...without it looking like a storm: */
+    ymo_assert(toq.drain == 0);
+    ymo_assert(no_storms == 0);
+    ymo_assert(!toq.throttled);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_set_after_config();
+    test_bsat_set_after_live();
+    test_bsat_set_after_drain();
+    return 0;
+}
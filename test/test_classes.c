@@ -0,0 +1,135 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_PER_CLASS 5
+#define CLASS_PREMIUM 0
+#define CLASS_FREE 1
+
+static unsigned int expired_classes[2 * NO_PER_CLASS];
+static size_t no_class_expired = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void class_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    ymo_assert(no_class_expired < 2 * NO_PER_CLASS);
+    expired_classes[no_class_expired++] = item->cls;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_classes_config(void)
+{
+    EV_P = ev_default_loop(0);
+    ev_tstamp bad[] = { 0.1, 0.0 };
+    ev_tstamp good[] = { 0.2, 0.1 };
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, class_cb, 0.1);
+
+    ymo_assert(bsat_toq_set_classes(&toq, bad, 2) == -1);
+    ymo_assert(errno == EINVAL);
+
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    ymo_assert(bsat_timeout_set_class(&toq, &timeout, 1) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_class_stats(&toq, 0) == NULL);
+
+    /* Classes don't mix with jitter or stages: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.01, 4) == 0);
+    ymo_assert(bsat_toq_set_classes(&toq, good, 2) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.0, 0) == 0);
+
+    ymo_assert(bsat_toq_set_classes(&toq, good, 2) == 0);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.01, 4) == -1);
+    ymo_assert(bsat_toq_set_stages(&toq, good, 2) == -1);
+    ymo_assert(bsat_timeout_set_class(&toq, &timeout, 2) == -1);
+    ymo_assert(bsat_toq_class_stats(&toq, 1) != NULL);
+    ymo_assert(bsat_toq_class_stats(&toq, 2) == NULL);
+
+    /* Changing the class of an active item moves it: */
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(toq.lanes[0].head == &timeout);
+    ymo_assert(bsat_timeout_set_class(&toq, &timeout, 1) == 0);
+    ymo_assert(bsat_valid_items(&toq.lanes[0]) == 0);
+    ymo_assert(toq.lanes[1].head == &timeout);
+
+    ymo_assert(bsat_toq_set_classes(&toq, good, 2) == -1);
+    ymo_assert(errno == EBUSY);
+    bsat_toq_clear(&toq);
+
+    ymo_assert(bsat_toq_set_classes(&toq, NULL, 0) == 0);
+    ymo_assert(toq.lanes == NULL);
+    ymo_assert(toq.class_stats == NULL);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_classes_priority(void)
+{
+    EV_P = ev_default_loop(0);
+    ev_tstamp afters[] = { 0.02, 0.02 };
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, class_cb, 0.02);
+    ymo_assert(bsat_toq_set_classes(&toq, afters, 2) == 0);
+    bsat_toq_set_storm(&toq, NULL, 1.0, 2);
+
+    /* Free tier items are started first, so they're due first: */
+    bsat_timeout_t timeouts[2 * NO_PER_CLASS];
+    for( size_t i=0; i<2 * NO_PER_CLASS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        unsigned int cls = i < NO_PER_CLASS ? CLASS_FREE : CLASS_PREMIUM;
+        ymo_assert(bsat_timeout_set_class(&toq, &timeouts[i], cls) == 0);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+    ymo_assert(bsat_valid_items(&toq.lanes[CLASS_PREMIUM]) == NO_PER_CLASS);
+    ymo_assert(bsat_valid_items(&toq.lanes[CLASS_FREE]) == NO_PER_CLASS);
+
+    /* ...but with a budget of 2 per iteration, premium drains first: */
+    ev_run(loop, 0);
+    ymo_assert(no_class_expired == 2 * NO_PER_CLASS);
+    for( size_t i=0; i<2 * NO_PER_CLASS; i++ ) {
+        ymo_assert(expired_classes[i] ==
+                (i < NO_PER_CLASS ? CLASS_PREMIUM : CLASS_FREE));
+    }
+
+    bsat_class_stats_t* premium = bsat_toq_class_stats(&toq, CLASS_PREMIUM);
+    bsat_class_stats_t* free_tier = bsat_toq_class_stats(&toq, CLASS_FREE);
+    ymo_assert(premium->expired == NO_PER_CLASS);
+    ymo_assert(free_tier->expired == NO_PER_CLASS);
+    ymo_assert(free_tier->deferred > premium->deferred);
+    ymo_assert(free_tier->lateness_max >= premium->lateness_max);
+    ymo_assert(premium->lateness_sum >= 0.0);
+
+    bsat_toq_stop(&toq);
+    bsat_toq_set_classes(&toq, NULL, 0);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_classes_config();
+    test_bsat_classes_priority();
+    return 0;
+}
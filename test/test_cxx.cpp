@@ -0,0 +1,112 @@
+#include <utility>
+
+#include "bsat.hpp"
+#include "ymo_assert.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky types:
+ *-------------------------------------------------------------*/
+struct connection {
+    int            id;
+    bsat::timeout  idle;
+    int            no_idle;
+
+    explicit connection(int id) : id(id), no_idle(0) {}
+
+    void on_idle()
+    {
+        no_idle++;
+        ymo_assert(!idle.active());
+    }
+};
+
+typedef bsat::queue<connection, &connection::idle, &connection::on_idle>
+    idle_queue_t;
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_cxx_dispatch(void)
+{
+    struct ev_loop* loop = ev_default_loop(0);
+    idle_queue_t queue(loop, 0.01);
+
+    connection a(1);
+    connection b(2);
+    queue.start(a);
+    queue.start(b);
+    ymo_assert(a.idle.active());
+    ymo_assert(queue.get()->head == a.idle.get());
+
+    /* The handler is invoked on the right owner: */
+    queue.stop(b);
+    ev_run(loop, 0);
+    ymo_assert(a.no_idle == 1);
+    ymo_assert(b.no_idle == 0);
+    ymo_assert(queue.get()->head == NULL);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_cxx_raii(void)
+{
+    struct ev_loop* loop = ev_default_loop(0);
+    idle_queue_t queue(loop, 0.01);
+
+    connection a(1);
+    queue.start(a);
+
+    /* Destroying an owner unlinks its timeout: */
+    {
+        connection doomed(2);
+        queue.start(doomed);
+        queue.reset(a);
+        ymo_assert(queue.get()->head == doomed.idle.get());
+    }
+    ymo_assert(queue.get()->head == a.idle.get());
+    ymo_assert(queue.get()->tail == a.idle.get());
+
+    /* Moving a handle keeps its position in the queue: */
+    connection b(3);
+    connection c(4);
+    queue.start(b);
+    queue.start(c);
+    connection moved(5);
+    moved.idle = std::move(b.idle);
+    ymo_assert(!b.idle.active());
+    ymo_assert(moved.idle.active());
+    ymo_assert(queue.get()->head->next == moved.idle.get());
+    ymo_assert(moved.idle.get()->next == c.idle.get());
+
+    ev_run(loop, 0);
+    ymo_assert(a.no_idle == 1);
+    ymo_assert(b.no_idle == 0);
+    ymo_assert(moved.no_idle == 1);
+    ymo_assert(c.no_idle == 1);
+
+    /* Destroying the queue stops everything left in it: */
+    connection d(6);
+    {
+        idle_queue_t doomed_queue(loop, 0.01);
+        doomed_queue.start(d);
+    }
+    ymo_assert(!d.idle.active());
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_cxx_dispatch();
+    test_bsat_cxx_raii();
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_EVICT_ITEMS 6
+
+static bsat_timeout_t timeouts[NO_EVICT_ITEMS];
+static size_t evicted_order[NO_EVICT_ITEMS];
+static size_t no_evicted = 0;
+static int stop_on_evict = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void evict_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    ymo_assert(no_evicted < NO_EVICT_ITEMS);
+    ymo_assert(!bsat_timeout_is_active(item));
+    evicted_order[no_evicted++] = (size_t)(item - timeouts);
+    if( stop_on_evict ) {
+        bsat_toq_stop(toq);
+    }
+}
+
+
+/* Start the items a few ms apart, oldest first: */
+static void start_staggered(EV_P_ bsat_toq_t* toq)
+{
+    no_evicted = 0;
+    for( size_t i=0; i<NO_EVICT_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(toq, &timeouts[i]);
+        ev_sleep(0.005);
+        ev_now_update(EV_A);
+    }
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_evict_oldest(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, evict_cb, 60.0);
+    start_staggered(EV_A_ &toq);
+
+    ymo_assert(bsat_toq_evict_oldest(&toq, 2) == 2);
+    ymo_assert(no_evicted == 2);
+    ymo_assert(evicted_order[0] == 0);
+    ymo_assert(evicted_order[1] == 1);
+    ymo_assert(toq.head == &timeouts[2]);
+
+    /* Asking for more than there is evicts everything: */
+    ymo_assert(bsat_toq_evict_oldest(&toq, 100) == NO_EVICT_ITEMS - 2);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(bsat_toq_evict_oldest(&toq, 1) == 0);
+
+    /* Jitter lanes are evicted by idle time, not by deadline: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 10.0, 4) == 0);
+    start_staggered(EV_A_ &toq);
+    ymo_assert(bsat_toq_evict_oldest(&toq, NO_EVICT_ITEMS) == NO_EVICT_ITEMS);
+    for( size_t i=0; i<NO_EVICT_ITEMS; i++ ) {
+        ymo_assert(evicted_order[i] == i);
+    }
+
+    bsat_toq_clear(&toq);
+    bsat_toq_set_jitter(&toq, 0.0, 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_evict_idle(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, evict_cb, 60.0);
+    start_staggered(EV_A_ &toq);
+
+    /* Only items idle for at least secs go: */
+    ymo_assert(bsat_toq_evict_idle_longer_than(&toq, 1.0, 0) == 0);
+    ev_tstamp idle = ev_now(loop) - timeouts[2].tstamp;
+    ymo_assert(bsat_toq_evict_idle_longer_than(&toq, idle, 0) == 3);
+    ymo_assert(toq.head == &timeouts[3]);
+
+    /* ...at most n at a time: */
+    ymo_assert(bsat_toq_evict_idle_longer_than(&toq, 0.0, 1) == 1);
+    ymo_assert(no_evicted == 4);
+
+    /* Callbacks that stop the queue stop the eviction: */
+    stop_on_evict = 1;
+    ymo_assert(bsat_toq_evict_idle_longer_than(&toq, 0.0, 0) == 1);
+    stop_on_evict = 0;
+    bsat_toq_clear(&toq);
+
+    /* Groups go as a whole: */
+    bsat_timeout_group_t group;
+    bsat_timeout_group_init(&group);
+    no_evicted = 0;
+    for( size_t i=0; i<3; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        ymo_assert(bsat_timeout_group_add(&group, &timeouts[i]) == 0);
+    }
+    bsat_timeout_group_start(&toq, &group);
+    ymo_assert(bsat_toq_evict_oldest(&toq, 1) == 3);
+    ymo_assert(no_evicted == 3);
+    ymo_assert(group.no_items == 0);
+
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_pressure_open(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, evict_cb, 60.0);
+
+    bsat_pressure_t pressure;
+    ymo_assert(bsat_pressure_open(&pressure, &toq,
+                "/nonexistent/memory.pressure", "some 150000 2000000", 10)
+            == -1);
+    ymo_assert(errno == ENOENT || errno == ENOSYS);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_evict_oldest();
+    test_bsat_evict_idle();
+    test_bsat_pressure_open();
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <pthread.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_EXECUTOR_ITEMS 150
+#define NO_EXECUTOR_THREADS 3
+#define EXECUTOR_AFTER 0.01
+
+static pthread_t main_thread;
+static bsat_timeout_t timeouts[NO_EXECUTOR_ITEMS];
+static size_t no_worked = 0;
+static size_t no_worked_inline = 0;
+static size_t no_done = 0;
+static size_t no_done_elsewhere = 0;
+static size_t no_done_early = 0;
+static int worked[NO_EXECUTOR_ITEMS];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+/* The "real work" — off the loop, if all goes well: */
+static void work_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( pthread_equal(pthread_self(), main_thread) ) {
+        __atomic_add_fetch(&no_worked_inline, 1, __ATOMIC_RELAXED);
+    }
+    ev_sleep(0.001);
+    __atomic_store_n(&worked[item - timeouts], 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&no_worked, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Cleaning up, back on the loop: */
+static void done_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( !pthread_equal(pthread_self(), main_thread) ) {
+        no_done_elsewhere++;
+    }
+    if( !__atomic_load_n(&worked[item - timeouts], __ATOMIC_ACQUIRE) ) {
+        no_done_early++;
+    }
+    ymo_assert(!bsat_timeout_is_active(item));
+    no_done++;
+}
+
+
+static void start_items(bsat_toq_t* toq)
+{
+    no_worked = no_worked_inline = 0;
+    no_done = no_done_elsewhere = no_done_early = 0;
+    for( size_t i=0; i<NO_EXECUTOR_ITEMS; i++ ) {
+        worked[i] = 0;
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(toq, &timeouts[i]);
+    }
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_executor(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_executor_t executor;
+    ymo_assert(bsat_executor_open(EV_A_ &executor, 0, done_cb) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_executor_open(
+                EV_A_ &executor, NO_EXECUTOR_THREADS, done_cb) == 0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, work_cb, EXECUTOR_AFTER);
+    bsat_toq_set_executor(&toq, &executor);
+    start_items(&toq);
+
+    /* The loop keeps running until the last batch has come back: */
+    ev_tstamp started = ev_time();
+    ev_run(EV_A_ 0);
+    ymo_assert(no_worked == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_worked_inline == 0);
+    ymo_assert(no_done == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_done_elsewhere == 0);
+    ymo_assert(no_done_early == 0);
+    ymo_assert(executor.in_flight == 0);
+    ymo_assert(executor.no_batches
+            >= (NO_EXECUTOR_ITEMS + BSAT_BATCH_SIZE - 1) / BSAT_BATCH_SIZE);
+
+    /* ...which took less time than doing the work on the loop would: */
+    ymo_assert(ev_time() - started < EXECUTOR_AFTER + NO_EXECUTOR_ITEMS * 0.001);
+
+    bsat_executor_close(&executor);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_executor_close(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_executor_t executor;
+    ymo_assert(bsat_executor_open(EV_A_ &executor, 1, done_cb) == 0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, work_cb, EXECUTOR_AFTER);
+    bsat_toq_set_executor(&toq, &executor);
+    start_items(&toq);
+
+    /* Expire everything, then close before the work is done: */
+    ev_sleep(EXECUTOR_AFTER);
+    ev_run(EV_A_ EVRUN_NOWAIT);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    bsat_toq_set_executor(&toq, NULL);
+    bsat_executor_close(&executor);
+
+    /* Everything got both of its callbacks, all the same: */
+    ymo_assert(no_worked == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_done == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_done_elsewhere == 0);
+    ymo_assert(no_done_early == 0);
+
+    /* Back to running callbacks inline: */
+    start_items(&toq);
+    ev_run(EV_A_ 0);
+    ymo_assert(no_worked == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_worked_inline == NO_EXECUTOR_ITEMS);
+    ymo_assert(no_done == 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_executor_evict(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_executor_t executor;
+    ymo_assert(bsat_executor_open(EV_A_ &executor, 2, done_cb) == 0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, work_cb, 60.0);
+    bsat_toq_set_executor(&toq, &executor);
+
+    /* An evicted group goes to the executor, just as if it had expired: */
+    no_worked = no_worked_inline = 0;
+    no_done = no_done_elsewhere = no_done_early = 0;
+    bsat_timeout_group_t group;
+    bsat_timeout_group_init(&group);
+    for( size_t i=0; i<3; i++ ) {
+        worked[i] = 0;
+        bsat_timeout_init(&timeouts[i]);
+        ymo_assert(bsat_timeout_group_add(&group, &timeouts[i]) == 0);
+    }
+    bsat_timeout_group_start(&toq, &group);
+    ymo_assert(bsat_toq_evict_oldest(&toq, 1) == 3);
+    ymo_assert(executor.in_flight == 1);
+    ev_run(EV_A_ 0);
+    ymo_assert(no_worked == 3);
+    ymo_assert(no_worked_inline == 0);
+    ymo_assert(no_done == 3);
+    ymo_assert(no_done_early == 0);
+
+    /* So do the items flushed by bsat_toq_invoke_pending: */
+    worked[3] = 0;
+    bsat_timeout_init(&timeouts[3]);
+    bsat_timeout_start(&toq, &timeouts[3]);
+    bsat_toq_invoke_pending(&toq);
+    ev_run(EV_A_ 0);
+    ymo_assert(no_worked == 4);
+    ymo_assert(no_done == 4);
+
+    bsat_toq_set_executor(&toq, NULL);
+    bsat_executor_close(&executor);
+    ymo_assert(no_worked_inline == 0);
+    ymo_assert(no_done_elsewhere == 0);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    main_thread = pthread_self();
+    test_bsat_executor();
+    test_bsat_executor_close();
+    test_bsat_executor_evict();
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_STREAMS 5
+
+static bsat_timeout_group_t session;
+static bsat_timeout_t streams[NO_STREAMS];
+static size_t expired_order[NO_STREAMS];
+static size_t no_expired = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void init_session(void)
+{
+    bsat_timeout_group_init(&session);
+    for( size_t i=0; i<NO_STREAMS; i++ ) {
+        bsat_timeout_init(&streams[i]);
+        streams[i].data = (void*)(uintptr_t)i;
+        ymo_assert(bsat_timeout_group_add(&session, &streams[i]) == 0);
+    }
+    ymo_assert(session.no_items == NO_STREAMS);
+    no_expired = 0;
+}
+
+
+static void stream_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    ymo_assert(no_expired < NO_STREAMS);
+    ymo_assert(item->group == NULL);
+    expired_order[no_expired++] = idx;
+
+    /* The first stream to go takes the next one with it: */
+    if( idx == 0 ) {
+        bsat_timeout_group_remove(&session, &streams[1]);
+    }
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_group_membership(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stream_cb, 0.01);
+    init_session();
+
+    /* Items can't join a second group, or join while active: */
+    bsat_timeout_group_t other;
+    bsat_timeout_group_init(&other);
+    ymo_assert(bsat_timeout_group_add(&other, &streams[0]) == -1);
+    ymo_assert(errno == EBUSY);
+
+    bsat_timeout_t active;
+    bsat_timeout_init(&active);
+    bsat_timeout_start(&toq, &active);
+    ymo_assert(bsat_timeout_group_add(&other, &active) == -1);
+    ymo_assert(errno == EBUSY);
+    bsat_timeout_stop(&toq, &active);
+
+    /* Removal from the middle and the ends: */
+    bsat_timeout_group_remove(&session, &streams[2]);
+    bsat_timeout_group_remove(&session, &streams[0]);
+    bsat_timeout_group_remove(&session, &streams[4]);
+    bsat_timeout_group_remove(&other, &streams[1]);
+    ymo_assert(session.no_items == 2);
+    ymo_assert(session.head == &streams[1]);
+    ymo_assert(session.tail == &streams[3]);
+    ymo_assert(streams[2].group == NULL);
+
+    /* The group is a single node in the queue, however big it is: */
+    bsat_timeout_group_start(&toq, &session);
+    ymo_assert(bsat_valid_items(&toq) == 1);
+    ymo_assert(toq.head == &session.node);
+    bsat_timeout_group_reset(&toq, &session);
+    ymo_assert(bsat_valid_items(&toq) == 1);
+
+    bsat_timeout_group_stop(&toq, &session);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(session.no_items == 2);
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_group_expire(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stream_cb, 0.01);
+    init_session();
+
+    bsat_timeout_group_start(&toq, &session);
+    ev_run(loop, 0);
+
+    /* Every stream but the one removed by the callback expired, in order: */
+    ymo_assert(no_expired == NO_STREAMS - 1);
+    ymo_assert(expired_order[0] == 0);
+    ymo_assert(expired_order[1] == 2);
+    ymo_assert(expired_order[2] == 3);
+    ymo_assert(expired_order[3] == 4);
+
+    ymo_assert(session.no_items == 0);
+    ymo_assert(session.head == NULL && session.tail == NULL);
+    ymo_assert(bsat_timeout_is_active(&session.node) == 0);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    /* Re-added items wait for the next expiry: */
+    no_expired = 0;
+    ymo_assert(bsat_timeout_group_add(&session, &streams[3]) == 0);
+    bsat_timeout_group_start(&toq, &session);
+    bsat_toq_invoke_pending(&toq);
+    ymo_assert(no_expired == 1);
+    ymo_assert(expired_order[0] == 3);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_group_standalone(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stream_cb, 0.01);
+    init_session();
+
+    /* A grouped item can't be started or reset on its own — it would be in
+     * the queue and the group at once: */
+    bsat_timeout_start(&toq, &streams[1]);
+    bsat_timeout_reset(&toq, &streams[2]);
+    bsat_timeout_t* batch[] = { &streams[3], &streams[4] };
+    ymo_assert(bsat_timeout_start_batch(&toq, batch, 2) == 0);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    for( size_t i=0; i<NO_STREAMS; i++ ) {
+        ymo_assert(!bsat_timeout_is_active(&streams[i]));
+        ymo_assert(streams[i].group == &session);
+    }
+    ymo_assert(session.head == &streams[0] && session.tail == &streams[4]);
+
+    /* ...so the group still expires as a whole: */
+    bsat_timeout_group_start(&toq, &session);
+    bsat_timeout_start(&toq, &streams[0]);
+    ymo_assert(bsat_valid_items(&toq) == 1);
+    ev_run(loop, 0);
+    ymo_assert(no_expired == NO_STREAMS - 1);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    /* Once it's out of the group, it's an item like any other: */
+    bsat_timeout_start(&toq, &streams[0]);
+    ymo_assert(bsat_timeout_is_active(&streams[0]));
+    bsat_timeout_stop(&toq, &streams[0]);
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_group_membership();
+    test_bsat_group_expire();
+    test_bsat_group_standalone();
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+#define NO_JITTER_TIMEOUTS 64
+#define NO_JITTER_LANES 8
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+static size_t no_expired = 0;
+static ev_tstamp expired_at[NO_JITTER_TIMEOUTS];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void jitter_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    expired_at[no_expired++] = ev_now(toq->loop);
+    ymo_assert(!bsat_timeout_is_active(item));
+}
+
+
+static size_t bsat_valid_lane_items(bsat_toq_t* toq)
+{
+    size_t no_items = 0;
+    for( unsigned int i=0; i<toq->no_lanes; i++ ) {
+        /* Each lane should be a valid FIFO: */
+        ev_tstamp last = 0.0;
+        bsat_timeout_t* cur = toq->lanes[i].head;
+        while( cur ) {
+            ymo_assert(cur->tstamp >= last);
+            last = cur->tstamp;
+            cur = cur->next;
+        }
+        no_items += bsat_valid_items(&toq->lanes[i]);
+    }
+    ymo_assert(toq->head == NULL);
+    return no_items;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_jitter_config(void)
+{
+    EV_P = ev_default_loop(0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, jitter_cb, 0.1);
+
+    /* Jitter can't exceed the timeout period: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.1, NO_JITTER_LANES) == -1);
+    ymo_assert(errno == EINVAL);
+
+    /* Jitter can't change while items are pending: */
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.05, NO_JITTER_LANES) == -1);
+    ymo_assert(errno == EBUSY);
+    bsat_timeout_stop(&toq, &timeout);
+
+    /* Lane offsets should span [-jitter, +jitter]: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.05, NO_JITTER_LANES) == 0);
+    ymo_assert(toq.no_lanes == NO_JITTER_LANES);
+    ymo_assert(toq.lanes[0].after > 0.0499 && toq.lanes[0].after < 0.0501);
+    ymo_assert(toq.lanes[NO_JITTER_LANES-1].after > 0.1499
+            && toq.lanes[NO_JITTER_LANES-1].after < 0.1501);
+
+    /* Disabling jitter frees the lanes: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.0, 0) == 0);
+    ymo_assert(toq.lanes == NULL && toq.no_lanes == 0);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_jitter(void)
+{
+    EV_P = ev_default_loop(0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, jitter_cb, 0.1);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.05, NO_JITTER_LANES) == 0);
+
+    /* Start a burst of timeouts in the same tick: */
+    bsat_timeout_t timeouts[NO_JITTER_TIMEOUTS];
+    for( size_t i=0; i<NO_JITTER_TIMEOUTS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+    ymo_assert(bsat_valid_lane_items(&toq) == NO_JITTER_TIMEOUTS);
+
+    /* Items should be spread across more than one lane: */
+    unsigned int lanes_used = 0;
+    for( unsigned int i=0; i<toq.no_lanes; i++ ) {
+        if( toq.lanes[i].head ) {
+            lanes_used++;
+        }
+    }
+    ymo_assert(lanes_used > 1);
+
+    /* Each item's deadline comes from its own lane: */
+    ev_tstamp min_deadline = 0.0;
+    ev_tstamp max_deadline = 0.0;
+    for( size_t i=0; i<NO_JITTER_TIMEOUTS; i++ ) {
+        ev_tstamp deadline = bsat_timeout_deadline(&toq, &timeouts[i]);
+        ymo_assert(deadline >= timeouts[i].tstamp + 0.0499);
+        ymo_assert(deadline <= timeouts[i].tstamp + 0.1501);
+        if( !i || deadline < min_deadline ) {
+            min_deadline = deadline;
+        }
+        if( deadline > max_deadline ) {
+            max_deadline = deadline;
+        }
+    }
+    ymo_assert(max_deadline > min_deadline);
+
+    /* Resets and stops work through the lanes: */
+    bsat_timeout_reset(&toq, &timeouts[0]);
+    bsat_timeout_stop(&toq, &timeouts[1]);
+    ymo_assert(bsat_valid_lane_items(&toq) == NO_JITTER_TIMEOUTS - 1);
+    ymo_assert(bsat_timeout_deadline(&toq, &timeouts[1]) == -1.0);
+
+    /* Run until everything expires: */
+    ev_tstamp started = ev_now(loop);
+    while( no_expired < NO_JITTER_TIMEOUTS - 1 ) {
+        ev_run(loop, EVRUN_ONCE);
+    }
+    ymo_assert(bsat_valid_lane_items(&toq) == 0);
+
+    /* Nothing expires before its (jittered) deadline, and expirations come in
+     * deadline order: */
+    ymo_assert(expired_at[0] >= started + 0.05);
+    ymo_assert(expired_at[0] >= min_deadline);
+    for( size_t i=1; i<no_expired; i++ ) {
+        ymo_assert(expired_at[i] >= expired_at[i-1]);
+    }
+
+    /* ...and they don't all expire in the same tick: */
+    ymo_assert(expired_at[no_expired-1] > expired_at[0]);
+
+    bsat_toq_stop(&toq);
+    bsat_toq_set_jitter(&toq, 0.0, 0);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_jitter_config();
+    test_bsat_jitter();
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_POLL_ITEMS 5
+
+static ev_tstamp fake_now = 1000.0;
+static size_t no_cb_calls = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static ev_tstamp fake_clock(bsat_toq_t* toq)
+{
+    return fake_now;
+}
+
+
+static void poll_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    no_cb_calls++;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_poll_expired(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, poll_cb, 10.0);
+    bsat_toq_set_poll_mode(&toq, fake_clock);
+
+    ev_tstamp next;
+    bsat_timeout_t* out[NO_POLL_ITEMS];
+    ymo_assert(bsat_toq_poll_expired(&toq, fake_now, out, 1, &next) == 0);
+    ymo_assert(next == -1.0);
+
+    /* Items are stamped by the queue's clock, and the timer stays off: */
+    bsat_timeout_t timeouts[NO_POLL_ITEMS];
+    for( size_t i=0; i<NO_POLL_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+        ymo_assert(timeouts[i].tstamp == fake_now);
+        fake_now += 1.0;
+    }
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    ymo_assert(bsat_toq_poll_expired(&toq, fake_now, out, 1, &next) == 0);
+    ymo_assert(next == 1010.0);
+
+    /* Up to max at a time, in order — and the next deadline says whether
+     * there's more to collect: */
+    fake_now = 1013.5;
+    ymo_assert(bsat_toq_poll_expired(&toq, fake_now, out, 2, &next) == 2);
+    ymo_assert(out[0] == &timeouts[0] && out[1] == &timeouts[1]);
+    ymo_assert(!bsat_timeout_is_active(out[0]));
+    ymo_assert(next == 1012.0);
+
+    ymo_assert(bsat_toq_poll_expired(&toq, fake_now, out, 5, NULL) == 2);
+    ymo_assert(out[0] == &timeouts[2] && out[1] == &timeouts[3]);
+    ymo_assert(bsat_valid_items(&toq) == 1);
+
+    /* Resets use the clock, too: */
+    bsat_timeout_reset(&toq, &timeouts[4]);
+    ymo_assert(timeouts[4].tstamp == fake_now);
+    ymo_assert(bsat_toq_poll_expired(&toq, fake_now, out, 5, &next) == 0);
+    ymo_assert(next == fake_now + 10.0);
+    ymo_assert(no_cb_calls == 0);
+
+    /* Back to timer mode: */
+    bsat_toq_set_poll_mode(&toq, NULL);
+    ymo_assert(ev_is_active(&toq.timer));
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_poll_stages(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, poll_cb, 1.0);
+    bsat_toq_set_poll_mode(&toq, fake_clock);
+
+    ev_tstamp afters[] = { 1.0, 2.0 };
+    ymo_assert(bsat_toq_set_stages(&toq, afters, 2) == 0);
+
+    fake_now = 2000.0;
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+
+    /* The first stage ends — the item moves on, and is still active: */
+    ev_tstamp next;
+    bsat_timeout_t* out[2];
+    ymo_assert(bsat_toq_poll_expired(&toq, 2001.5, out, 2, &next) == 1);
+    ymo_assert(out[0] == &timeout);
+    ymo_assert(bsat_timeout_is_active(&timeout));
+    ymo_assert(timeout.stage == 1);
+    ymo_assert(next == 2003.0);
+
+    /* The final stage ends: */
+    ymo_assert(bsat_toq_poll_expired(&toq, 2003.0, out, 2, &next) == 1);
+    ymo_assert(!bsat_timeout_is_active(&timeout));
+    ymo_assert(next == -1.0);
+    ymo_assert(no_cb_calls == 0);
+
+    bsat_toq_set_stages(&toq, NULL, 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_poll_zero_clock(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, poll_cb, 10.0);
+    bsat_toq_set_poll_mode(&toq, fake_clock);
+
+    /* A clock which starts from zero (e.g. time since boot, or a counter)
+     * stamps items with 0 — which doesn't make them any less active: */
+    fake_now = 0.0;
+    bsat_timeout_t timeouts[2];
+    bsat_timeout_init(&timeouts[0]);
+    bsat_timeout_init(&timeouts[1]);
+    bsat_timeout_start(&toq, &timeouts[0]);
+    ymo_assert(timeouts[0].tstamp == 0.0);
+    ymo_assert(bsat_timeout_is_active(&timeouts[0]));
+
+    /* Starting it again is a no-op, rather than linking it twice: */
+    bsat_timeout_start(&toq, &timeouts[0]);
+    bsat_timeout_start(&toq, &timeouts[1]);
+    ymo_assert(bsat_valid_items(&toq) == 2);
+    ymo_assert(toq.head == &timeouts[0] && toq.tail == &timeouts[1]);
+    ymo_assert(timeouts[0].next == &timeouts[1]);
+
+    /* Resets move it along, and stops take it out: */
+    fake_now = 1.0;
+    bsat_timeout_reset(&toq, &timeouts[0]);
+    ymo_assert(toq.head == &timeouts[1] && toq.tail == &timeouts[0]);
+    bsat_timeout_stop(&toq, &timeouts[1]);
+    ymo_assert(!bsat_timeout_is_active(&timeouts[1]));
+    ymo_assert(bsat_valid_items(&toq) == 1);
+
+    ev_tstamp next;
+    bsat_timeout_t* out[2];
+    ymo_assert(bsat_toq_poll_expired(&toq, 11.0, out, 2, &next) == 1);
+    ymo_assert(out[0] == &timeouts[0]);
+    ymo_assert(!bsat_timeout_is_active(&timeouts[0]));
+    ymo_assert(next == -1.0);
+
+    bsat_toq_set_poll_mode(&toq, NULL);
+    fake_now = 1000.0;
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_poll_expired();
+    test_bsat_poll_stages();
+    test_bsat_poll_zero_clock();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_POOL_ITEMS 100
+#define POOL_HUGE_PAGE ((uintptr_t)2 << 20)
+
+/* Something a pool might hold: */
+typedef struct pool_conn {
+    int fd;
+    bsat_timeout_t timeout;
+    char state[20];
+} pool_conn_t;
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_pool(void)
+{
+    bsat_pool_t pool;
+    ymo_assert(bsat_pool_open(&pool, 0, NO_POOL_ITEMS, 0) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_pool_open(&pool, sizeof(pool_conn_t), 0, 0) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_pool_open(&pool, SIZE_MAX / 2, 4, 0) == -1);
+    ymo_assert(errno == EINVAL);
+
+    ymo_assert(bsat_pool_open(&pool, sizeof(pool_conn_t), NO_POOL_ITEMS, 0)
+            == 0);
+    ymo_assert(pool.backing == 0);
+    ymo_assert(pool.node == -1);
+    ymo_assert(pool.item_size >= sizeof(pool_conn_t));
+    ymo_assert(pool.item_size % 16 == 0);
+
+    /* Items are aligned, zeroed, and don't overlap: */
+    pool_conn_t* conns[NO_POOL_ITEMS];
+    size_t no_bad = 0;
+    for( size_t i=0; i<NO_POOL_ITEMS; i++ ) {
+        conns[i] = bsat_pool_alloc(&pool);
+        if( !conns[i] || (uintptr_t)conns[i] % 16 || conns[i]->fd ) {
+            no_bad++;
+        } else {
+            conns[i]->fd = (int)i + 1;
+            bsat_timeout_init(&conns[i]->timeout);
+        }
+    }
+    ymo_assert(no_bad == 0);
+    for( size_t i=0; i<NO_POOL_ITEMS; i++ ) {
+        if( conns[i]->fd != (int)i + 1 ) {
+            no_bad++;
+        }
+    }
+    ymo_assert(no_bad == 0);
+    ymo_assert(pool.no_items == NO_POOL_ITEMS);
+
+    /* Until it runs out: */
+    ymo_assert(bsat_pool_alloc(&pool) == NULL);
+    ymo_assert(errno == ENOMEM);
+
+    /* Freed items are reused, most recent first: */
+    bsat_pool_free(&pool, conns[3]);
+    bsat_pool_free(&pool, conns[7]);
+    bsat_pool_free(&pool, NULL);
+    ymo_assert(pool.no_items == NO_POOL_ITEMS - 2);
+    ymo_assert(bsat_pool_alloc(&pool) == conns[7]);
+    ymo_assert(bsat_pool_alloc(&pool) == conns[3]);
+    ymo_assert(bsat_pool_alloc(&pool) == NULL);
+
+    bsat_pool_close(&pool);
+    ymo_assert(pool.base == NULL);
+    ymo_assert(pool.no_items == 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_pool_backing(void)
+{
+    /* Whatever the system has, the pool works — and says what it got: */
+    int flags = BSAT_POOL_HUGETLB | BSAT_POOL_THP | BSAT_POOL_NUMA_LOCAL;
+    bsat_pool_t pool;
+    ymo_assert(bsat_pool_open(&pool, sizeof(pool_conn_t), NO_POOL_ITEMS,
+                flags) == 0);
+    ymo_assert((pool.backing & ~flags) == 0);
+    ymo_assert(pool.size % POOL_HUGE_PAGE == 0);
+    ymo_assert((pool.node >= 0) == !!(pool.backing & BSAT_POOL_NUMA_LOCAL));
+
+    /* Huge pages or not, it starts on a huge page boundary: */
+    ymo_assert((uintptr_t)pool.base % POOL_HUGE_PAGE == 0);
+
+    pool_conn_t* conn = bsat_pool_alloc(&pool);
+    ymo_assert(conn == (pool_conn_t*)pool.base);
+    conn->fd = 1;
+    bsat_pool_close(&pool);
+
+    /* Transparent huge pages alone: */
+    ymo_assert(bsat_pool_open(&pool, sizeof(pool_conn_t), NO_POOL_ITEMS,
+                BSAT_POOL_THP) == 0);
+    ymo_assert((pool.backing & ~BSAT_POOL_THP) == 0);
+    ymo_assert((uintptr_t)pool.base % POOL_HUGE_PAGE == 0);
+    ymo_assert(pool.node == -1);
+    bsat_pool_close(&pool);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_pool();
+    test_bsat_pool_backing();
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_REARM_ITEMS 3
+#define NO_REARM_ROUNDS 3
+
+static size_t rearm_counts[NO_REARM_ITEMS];
+static size_t rearm_order[NO_REARM_ITEMS * NO_REARM_ROUNDS];
+static size_t no_rearm_calls = 0;
+static ev_tstamp called_at[2];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static ev_tstamp rearm_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    ymo_assert(bsat_timeout_is_active(item));
+    ymo_assert(no_rearm_calls < NO_REARM_ITEMS * NO_REARM_ROUNDS);
+
+    rearm_order[no_rearm_calls++] = idx;
+    if( ++rearm_counts[idx] < NO_REARM_ROUNDS ) {
+        return BSAT_REARM;
+    }
+    return BSAT_EXPIRE;
+}
+
+
+static ev_tstamp rearm_after_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    ymo_assert(no_rearm_calls < 2);
+    called_at[no_rearm_calls++] = ev_now(toq->loop);
+    if( no_rearm_calls == 1 ) {
+        return BSAT_REARM_AFTER(0.02);
+    }
+    return BSAT_EXPIRE;
+}
+
+
+static ev_tstamp stop_self_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    no_rearm_calls++;
+    bsat_timeout_stop(toq, item);
+
+    /* Ignored, since we stopped the item ourselves: */
+    return BSAT_REARM;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_rearm(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.02);
+    bsat_toq_set_rearm(&toq, rearm_cb);
+
+    bsat_timeout_t timeouts[NO_REARM_ITEMS];
+    for( size_t i=0; i<NO_REARM_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        timeouts[i].data = (void*)(uintptr_t)i;
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    /* Runs until every item has expired for good: */
+    no_rearm_calls = 0;
+    ev_run(loop, 0);
+    ymo_assert(no_calls == 0);
+    ymo_assert(no_rearm_calls == NO_REARM_ITEMS * NO_REARM_ROUNDS);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    /* Re-armed items go to the back of the line, so the order holds: */
+    for( size_t i=0; i<no_rearm_calls; i++ ) {
+        ymo_assert(rearm_order[i] == i % NO_REARM_ITEMS);
+    }
+
+    for( size_t i=0; i<NO_REARM_ITEMS; i++ ) {
+        ymo_assert(rearm_counts[i] == NO_REARM_ROUNDS);
+        ymo_assert(bsat_timeout_is_active(&timeouts[i]) == 0);
+    }
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_rearm_after(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.2);
+    bsat_toq_set_rearm(&toq, rearm_after_cb);
+
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+
+    no_rearm_calls = 0;
+    ev_run(loop, 0);
+    ymo_assert(no_rearm_calls == 2);
+
+    /* The second expiry comes early, per BSAT_REARM_AFTER: */
+    ymo_assert(called_at[1] - called_at[0] >= 0.02);
+    ymo_assert(called_at[1] - called_at[0] < 0.2);
+    ymo_assert(bsat_timeout_is_active(&timeout) == 0);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_rearm_stopped(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.01);
+    bsat_toq_set_rearm(&toq, stop_self_cb);
+
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+
+    no_rearm_calls = 0;
+    ev_run(loop, 0);
+    ymo_assert(no_rearm_calls == 1);
+    ymo_assert(bsat_timeout_is_active(&timeout) == 0);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    /* Going back to the plain callback: */
+    bsat_toq_set_rearm(&toq, NULL);
+    bsat_timeout_start(&toq, &timeout);
+    ev_run(loop, 0);
+    ymo_assert(no_calls == 1);
+    ymo_assert(no_rearm_calls == 1);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_rearm();
+    test_bsat_rearm_after();
+    test_bsat_rearm_stopped();
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_GROUP_ITEMS 6
+
+static bsat_timeout_t group[NO_GROUP_ITEMS];
+static size_t fired[NO_GROUP_ITEMS];
+static bsat_timeout_t late_item;
+static int restart_after_clear = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void start_group(bsat_toq_t* toq)
+{
+    for( size_t i=0; i<NO_GROUP_ITEMS; i++ ) {
+        bsat_timeout_init(&group[i]);
+        group[i].data = (void*)(uintptr_t)i;
+        fired[i] = 0;
+        bsat_timeout_start(toq, &group[i]);
+    }
+}
+
+
+/* The first item to expire takes its siblings (all but the last) with it: */
+static void close_group_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    fired[idx]++;
+    if( idx == 0 ) {
+        for( size_t i=1; i<NO_GROUP_ITEMS-1; i++ ) {
+            bsat_timeout_stop(toq, &group[i]);
+        }
+    }
+}
+
+
+static void clear_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    fired[idx]++;
+    bsat_toq_clear(toq);
+
+    /* Can't swap out lanes mid-dispatch, even with the queue empty: */
+    ymo_assert(bsat_toq_set_jitter(toq, toq->after / 2, 4) == -1);
+    ymo_assert(errno == EBUSY);
+
+    if( restart_after_clear ) {
+        bsat_timeout_init(&late_item);
+        bsat_timeout_start(toq, &late_item);
+    }
+}
+
+
+static void stop_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    fired[idx]++;
+    bsat_toq_stop(toq);
+}
+
+
+static ev_tstamp rearm_clear_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    size_t idx = (size_t)(uintptr_t)item->data;
+    fired[idx]++;
+    bsat_toq_clear(toq);
+    return BSAT_REARM;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_stop_siblings(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, close_group_cb, 0.01);
+
+    /* Every item in the group expires in the same dispatch: */
+    start_group(&toq);
+    ev_run(loop, 0);
+
+    ymo_assert(fired[0] == 1);
+    for( size_t i=1; i<NO_GROUP_ITEMS-1; i++ ) {
+        ymo_assert(fired[i] == 0);
+    }
+    ymo_assert(fired[NO_GROUP_ITEMS-1] == 1);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_clear_in_callback(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, clear_cb, 0.01);
+
+    restart_after_clear = 0;
+    start_group(&toq);
+    ev_run(loop, 0);
+
+    ymo_assert(fired[0] == 1);
+    for( size_t i=1; i<NO_GROUP_ITEMS; i++ ) {
+        ymo_assert(fired[i] == 0);
+        ymo_assert(bsat_timeout_is_active(&group[i]) == 0);
+    }
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    /* Starting an item in the (now empty) queue brings the timer back: */
+    restart_after_clear = 1;
+    start_group(&toq);
+    while( !fired[0] ) {
+        ev_run(loop, EVRUN_ONCE);
+    }
+    ymo_assert(bsat_valid_items(&toq) == 1);
+    ymo_assert(toq.head == &late_item);
+    ymo_assert(ev_is_active(&toq.timer));
+
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_stop_in_callback(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stop_cb, 0.01);
+
+    /* Stopping the queue ends the dispatch, even with items overdue: */
+    start_group(&toq);
+    ev_run(loop, 0);
+
+    ymo_assert(fired[0] == 1);
+    ymo_assert(fired[1] == 0);
+    ymo_assert(bsat_valid_items(&toq) == NO_GROUP_ITEMS-1);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_rearm_clear(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.01);
+    bsat_toq_set_rearm(&toq, rearm_clear_cb);
+
+    /* Clearing the queue wins over the BSAT_REARM disposition: */
+    start_group(&toq);
+    ev_run(loop, 0);
+
+    ymo_assert(fired[0] == 1);
+    ymo_assert(bsat_timeout_is_active(&group[0]) == 0);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_stop_siblings();
+    test_bsat_clear_in_callback();
+    test_bsat_stop_in_callback();
+    test_bsat_rearm_clear();
+    return 0;
+}
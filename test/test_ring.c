@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <string.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_RING_OWNERS 8
+#define RING_AFTER 10.0
+#define RING_RESOLUTION 0.25
+#define RING_BASE 1000.0
+#define NO_SCAN_TICKS 100
+
+static uint32_t expired[64];
+static size_t no_expired = 0;
+static uint32_t restart_owner = BSAT_RING_NONE;
+static ev_tstamp restart_at = 0.0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void ring_cb(bsat_ring_t* ring, uint32_t owner)
+{
+    ymo_assert(!bsat_ring_is_active(ring, owner));
+    expired[no_expired++] = owner;
+
+    /* Items can be started and reset from the callback: */
+    if( owner == restart_owner ) {
+        restart_owner = BSAT_RING_NONE;
+        ymo_assert(bsat_ring_start(ring, owner, restart_at) == 0);
+        ymo_assert(bsat_ring_reset(ring, 6, restart_at) == 0);
+        ymo_assert(bsat_ring_reset(ring, 7, restart_at) == 0);
+    }
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_ring(void)
+{
+    bsat_ring_t ring;
+    ymo_assert(bsat_ring_init(&ring, NO_RING_OWNERS, 4,
+                RING_AFTER, RING_RESOLUTION, RING_BASE, ring_cb) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_ring_init(&ring, NO_RING_OWNERS, 12,
+                RING_AFTER, RING_RESOLUTION, RING_BASE, ring_cb) == 0);
+    ymo_assert(ring.capacity == 16);
+    ymo_assert(bsat_ring_next_deadline(&ring) == -1.0);
+    ymo_assert(bsat_ring_start(&ring, NO_RING_OWNERS, RING_BASE) == -1);
+    ymo_assert(errno == EINVAL);
+
+    /* Owner i starts at i seconds: */
+    for( uint32_t i=0; i<NO_RING_OWNERS; i++ ) {
+        ymo_assert(bsat_ring_start(&ring, i, RING_BASE + i) == 0);
+    }
+    ymo_assert(ring.no_items == NO_RING_OWNERS);
+    ymo_assert(bsat_ring_next_deadline(&ring) == RING_BASE + RING_AFTER);
+
+    /* Resets leave tombstones behind — except within the same tick: */
+    ymo_assert(bsat_ring_reset(&ring, 0, RING_BASE + 8) == 0);
+    ymo_assert(bsat_ring_reset(&ring, 0, RING_BASE + 8.1) == 0);
+    bsat_ring_stop(&ring, 1);
+    ymo_assert(!bsat_ring_is_active(&ring, 1));
+    ymo_assert(ring.tail - ring.head == NO_RING_OWNERS + 1);
+    ymo_assert(ring.no_items == NO_RING_OWNERS - 1);
+    ymo_assert(bsat_ring_next_deadline(&ring) == RING_BASE + 2 + RING_AFTER);
+
+    /* Oldest first, up to max at a time: */
+    no_expired = 0;
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 15.5, 2) == 2);
+    ymo_assert(expired[0] == 2 && expired[1] == 3);
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 15.5, 0) == 2);
+    ymo_assert(expired[2] == 4 && expired[3] == 5);
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 15.5, 0) == 0);
+
+    /* Filling up squeezes out the tombstones, keeping everything in order: */
+    for( uint32_t i=0; i<5; i++ ) {
+        ymo_assert(bsat_ring_reset(&ring, 6, RING_BASE + 9 + i) == 0);
+        ymo_assert(bsat_ring_reset(&ring, 7, RING_BASE + 9.5 + i) == 0);
+    }
+    for( uint32_t i=1; i<5; i++ ) {
+        ymo_assert(bsat_ring_start(&ring, i, RING_BASE + 14) == 0);
+    }
+    ymo_assert(ring.no_compactions == 1);
+    ymo_assert(ring.no_items == 7);
+
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 100, 0) == 7);
+    ymo_assert(expired[4] == 0 && expired[5] == 6 && expired[6] == 7);
+    ymo_assert(expired[7] == 1 && expired[8] == 2);
+    ymo_assert(expired[9] == 3 && expired[10] == 4);
+    ymo_assert(ring.no_items == 0);
+    ymo_assert(bsat_ring_next_deadline(&ring) == -1.0);
+
+    bsat_ring_free(&ring);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_ring_callbacks(void)
+{
+    bsat_ring_t ring;
+    ymo_assert(bsat_ring_init(&ring, NO_RING_OWNERS, NO_RING_OWNERS,
+                RING_AFTER, RING_RESOLUTION, RING_BASE, ring_cb) == 0);
+
+    /* A full ring, so the callback's resets compact it: */
+    for( uint32_t i=0; i<NO_RING_OWNERS; i++ ) {
+        ymo_assert(bsat_ring_start(&ring, i, RING_BASE + i) == 0);
+    }
+    no_expired = 0;
+    restart_owner = 0;
+    restart_at = RING_BASE + 20;
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 15, 0) == 6);
+    ymo_assert(ring.no_compactions == 2);
+    for( size_t i=0; i<6; i++ ) {
+        ymo_assert(expired[i] == i);
+    }
+    ymo_assert(bsat_ring_is_active(&ring, 0));
+    ymo_assert(bsat_ring_next_deadline(&ring) == restart_at + RING_AFTER);
+
+    ymo_assert(bsat_ring_expire(&ring, RING_BASE + 100, 0) == 3);
+    ymo_assert(expired[6] == 0 && expired[7] == 6 && expired[8] == 7);
+    bsat_ring_free(&ring);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_ring_scan(void)
+{
+    bsat_ring_t ring;
+    ymo_assert(bsat_ring_init(&ring, 1, 1,
+                RING_AFTER, RING_RESOLUTION, RING_BASE, ring_cb) == 0);
+    ymo_assert(bsat_ring_set_isa(&ring, "mmx") == -1);
+    ymo_assert(errno == ENOTSUP);
+    ymo_assert(bsat_ring_set_isa(&ring, "scalar") == 0);
+    bsat_ring_scan_t scalar = ring.scan;
+
+    uint32_t ticks[NO_SCAN_TICKS];
+    for( size_t i=0; i<NO_SCAN_TICKS; i++ ) {
+        ticks[i] = 1000 + (uint32_t)i * 3;
+    }
+
+    /* Every kernel we have agrees with the scalar one, for every length
+     * and every threshold: */
+    const char* isas[] = { "avx2", "sse2", "neon" };
+    size_t no_mismatches = 0;
+    for( size_t k=0; k<sizeof(isas) / sizeof(isas[0]); k++ ) {
+        if( bsat_ring_set_isa(&ring, isas[k]) ) {
+            continue;
+        }
+        ymo_assert(!strcmp(ring.isa, isas[k]));
+
+        for( size_t n=0; n<=NO_SCAN_TICKS; n++ ) {
+            for( uint32_t now=998; now<1000 + 3 * NO_SCAN_TICKS; now+=2 ) {
+                if( ring.scan(ticks, n, now) != scalar(ticks, n, now) ) {
+                    no_mismatches++;
+                }
+            }
+        }
+    }
+    ymo_assert(no_mismatches == 0);
+    bsat_ring_free(&ring);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_ring();
+    test_bsat_ring_callbacks();
+    test_bsat_ring_scan();
+    return 0;
+}
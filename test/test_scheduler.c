@@ -0,0 +1,126 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_SCHEDULER_ITEMS 4
+
+static ev_tstamp fake_now = 500.0;
+static ev_tstamp fake_delay = -1.0;
+static size_t no_schedules = 0;
+static size_t no_scheduler_expired = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static ev_tstamp fake_clock(bsat_toq_t* toq)
+{
+    return fake_now;
+}
+
+
+/* Stands in for some other loop's timer: */
+static void fake_schedule(bsat_toq_t* toq, ev_tstamp delay)
+{
+    fake_delay = delay;
+    no_schedules++;
+}
+
+
+static void scheduler_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    no_scheduler_expired++;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_scheduler(void)
+{
+    /* No libev loop required: */
+    bsat_toq_t toq;
+    bsat_toq_init(NULL, &toq, scheduler_cb, 10.0);
+    ymo_assert(bsat_toq_set_scheduler(&toq, fake_schedule, NULL) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_scheduler(&toq, fake_schedule, fake_clock) == 0);
+    ymo_assert(fake_delay < 0.0);
+
+    /* Only the head of the queue sets the timer: */
+    bsat_timeout_t timeouts[NO_SCHEDULER_ITEMS];
+    for( size_t i=0; i<NO_SCHEDULER_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+        ymo_assert(timeouts[i].tstamp == fake_now);
+        fake_now += 1.0;
+    }
+    ymo_assert(fake_delay == 10.0);
+    no_schedules = 0;
+
+    /* Going off early expires nothing, and just sets it again: */
+    fake_now = 505.0;
+    bsat_toq_expire_due(&toq);
+    ymo_assert(no_scheduler_expired == 0);
+    ymo_assert(no_schedules == 1);
+    ymo_assert(fake_delay == 5.0);
+
+    /* Going off late expires what's due, and sets it for the rest: */
+    fake_now = 511.5;
+    bsat_toq_expire_due(&toq);
+    ymo_assert(no_scheduler_expired == 2);
+    ymo_assert(fake_delay == 0.5);
+    ymo_assert(bsat_valid_items(&toq) == 2);
+
+    /* Stopping the queue stops the timer: */
+    bsat_toq_stop(&toq);
+    ymo_assert(fake_delay < 0.0);
+
+    /* ...and clearing it leaves it stopped: */
+    bsat_toq_clear(&toq);
+    ymo_assert(fake_delay < 0.0);
+    ymo_assert(bsat_valid_items(&toq) == 0);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_scheduler_off(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, scheduler_cb, 10.0);
+    ymo_assert(bsat_toq_set_scheduler(&toq, fake_schedule, fake_clock) == 0);
+
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(fake_delay == 10.0);
+    ymo_assert(!ev_is_active(&toq.timer));
+
+    /* Switching back to libev stops the other timer and starts libev's: */
+    ymo_assert(bsat_toq_set_scheduler(&toq, NULL, NULL) == 0);
+    ymo_assert(fake_delay < 0.0);
+    ymo_assert(toq.clock == NULL);
+    ymo_assert(ev_is_active(&toq.timer));
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_scheduler();
+    test_bsat_scheduler_off();
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <pthread.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_SERVICE_LOOPS 4
+#define NO_SERVICE_ITEMS 3
+#define SERVICE_AFTER 0.05
+
+typedef struct service_loop {
+    pthread_t thread;
+    struct ev_loop* loop;
+    bsat_toq_t toq;
+    bsat_timeout_t timeouts[NO_SERVICE_ITEMS];
+    ev_tstamp deadlines[NO_SERVICE_ITEMS];
+    size_t no_expired;
+    ev_tstamp max_lateness;
+} service_loop_t;
+
+static bsat_service_t service;
+static service_loop_t loops[NO_SERVICE_LOOPS];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void service_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    service_loop_t* sl = toq->data;
+    ev_tstamp lateness = ev_now(toq->loop)
+        - sl->deadlines[item - sl->timeouts];
+    if( lateness > sl->max_lateness ) {
+        sl->max_lateness = lateness;
+    }
+    sl->no_expired++;
+}
+
+
+/* Start a few items 10ms apart, then run the loop until they've expired —
+ * which is when ev_run returns, since nothing else keeps it alive: */
+static void* run_loop(void* arg)
+{
+    service_loop_t* sl = arg;
+    for( size_t i=0; i<NO_SERVICE_ITEMS; i++ ) {
+        bsat_timeout_init(&sl->timeouts[i]);
+        bsat_timeout_start(&sl->toq, &sl->timeouts[i]);
+        sl->deadlines[i] = sl->timeouts[i].tstamp + SERVICE_AFTER;
+        ev_sleep(0.01);
+        ev_now_update(sl->loop);
+    }
+
+    ev_run(sl->loop, 0);
+    return NULL;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_service(void)
+{
+    ymo_assert(bsat_service_open(&service) == 0);
+    for( size_t i=0; i<NO_SERVICE_LOOPS; i++ ) {
+        service_loop_t* sl = &loops[i];
+        sl->loop = ev_loop_new(EVFLAG_AUTO);
+        bsat_toq_init(sl->loop, &sl->toq, service_cb, SERVICE_AFTER);
+        sl->toq.data = sl;
+        ymo_assert(bsat_service_add(&service, &sl->toq) == 0);
+    }
+    ymo_assert(service.no_queues == NO_SERVICE_LOOPS);
+
+    for( size_t i=0; i<NO_SERVICE_LOOPS; i++ ) {
+        ymo_assert(pthread_create(
+                    &loops[i].thread, NULL, run_loop, &loops[i]) == 0);
+    }
+    for( size_t i=0; i<NO_SERVICE_LOOPS; i++ ) {
+        pthread_join(loops[i].thread, NULL);
+    }
+
+    /* Every item expired on its own loop, on time — without its timer: */
+    for( size_t i=0; i<NO_SERVICE_LOOPS; i++ ) {
+        service_loop_t* sl = &loops[i];
+        ymo_assert(sl->no_expired == NO_SERVICE_ITEMS);
+        ymo_assert(sl->max_lateness >= 0.0);
+        ymo_assert(sl->max_lateness < SERVICE_AFTER);
+        ymo_assert(!ev_is_active(&sl->toq.timer));
+        ymo_assert(bsat_valid_items(&sl->toq) == 0);
+    }
+    ymo_assert(service.no_pending == 0);
+    ymo_assert(service.no_notifications >= NO_SERVICE_LOOPS);
+    ymo_assert(service.no_notifications
+            <= NO_SERVICE_LOOPS * NO_SERVICE_ITEMS);
+
+    for( size_t i=0; i<NO_SERVICE_LOOPS; i++ ) {
+        bsat_service_remove(&loops[i].toq);
+        ymo_assert(loops[i].toq.service == NULL);
+        ev_loop_destroy(loops[i].loop);
+    }
+    ymo_assert(service.no_queues == 0);
+    bsat_service_close(&service);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_service_remove(void)
+{
+    EV_P = ev_default_loop(0);
+    ymo_assert(bsat_service_open(&service) == 0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, service_cb, 10.0);
+    ymo_assert(bsat_service_add(&service, &toq) == 0);
+    ymo_assert(bsat_service_add(&service, &toq) == -1);
+    ymo_assert(errno == EBUSY);
+
+    /* An idle queue doesn't keep its loop running: */
+    ev_run(EV_A_ 0);
+
+    /* Deadlines go to the service, not the timer: */
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(!ev_is_active(&toq.timer));
+    ymo_assert(service.no_pending == 1);
+    ymo_assert(toq.service_at == timeout.tstamp + 10.0);
+
+    /* ...until the queue is taken back: */
+    bsat_service_remove(&toq);
+    ymo_assert(service.no_pending == 0);
+    ymo_assert(ev_is_active(&toq.timer));
+    bsat_toq_clear(&toq);
+    bsat_service_close(&service);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_service();
+    test_bsat_service_remove();
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_SHM_WORKERS 3
+#define NO_SHM_SLOTS 8
+#define NO_SHM_ITEMS 4
+#define SHM_BASE 1000.0
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+/* What each worker does, in its own process: item i of worker w is idle
+ * since SHM_BASE + 3 * i + w, so the workers' items interleave: */
+static void run_worker(bsat_shm_t* shm, unsigned int worker)
+{
+    uint32_t slots[NO_SHM_ITEMS];
+    for( size_t i=0; i<NO_SHM_ITEMS; i++ ) {
+        ymo_assert(bsat_shm_start(shm, worker, worker * 100 + i,
+                    SHM_BASE + 3 * i + worker, &slots[i]) == 0);
+    }
+
+    /* The first goes away, and the second comes back later: */
+    bsat_shm_stop(shm, worker, slots[0]);
+    bsat_shm_reset(shm, worker, slots[1], SHM_BASE + 50 + worker);
+}
+
+
+static int is_ordered(const bsat_shm_item_t* items, size_t n)
+{
+    for( size_t i=1; i<n; i++ ) {
+        if( items[i].tstamp < items[i - 1].tstamp ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_shm_fork(void)
+{
+    bsat_shm_t shm;
+    ymo_assert(bsat_shm_open(&shm, NULL, 0, NO_SHM_SLOTS) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_shm_open(
+                &shm, NULL, NO_SHM_WORKERS, NO_SHM_SLOTS) == 0);
+
+    /* Each worker writes its own list, in its own process: */
+    for( unsigned int w=0; w<NO_SHM_WORKERS; w++ ) {
+        pid_t pid = fork();
+        ymo_assert(pid >= 0);
+        if( !pid ) {
+            run_worker(&shm, w);
+            _exit(0);
+        }
+    }
+    for( unsigned int w=0; w<NO_SHM_WORKERS; w++ ) {
+        int status;
+        ymo_assert(wait(&status) > 0);
+        ymo_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    /* ...and the master sees them all, oldest first: */
+    bsat_shm_item_t items[NO_SHM_WORKERS * NO_SHM_ITEMS];
+    unsigned int no_skipped = 1;
+    size_t n = bsat_shm_scan_idle(&shm, INFINITY, items,
+            NO_SHM_WORKERS * NO_SHM_ITEMS, &no_skipped);
+    ymo_assert(no_skipped == 0);
+    ymo_assert(n == NO_SHM_WORKERS * (NO_SHM_ITEMS - 1));
+    ymo_assert(is_ordered(items, n));
+    ymo_assert(items[0].id == 2 && items[0].worker == 0);
+    ymo_assert(items[0].tstamp == SHM_BASE + 6);
+    ymo_assert(items[n - 1].id == 201 && items[n - 1].worker == 2);
+
+    /* Just the oldest: */
+    ymo_assert(bsat_shm_scan_idle(&shm, INFINITY, items, 1, NULL) == 1);
+    ymo_assert(items[0].id == 2);
+
+    /* Only items idle since before: */
+    n = bsat_shm_scan_idle(&shm, SHM_BASE + 8, items, NO_SHM_ITEMS, NULL);
+    ymo_assert(n == 3);
+    ymo_assert(items[0].id == 2 && items[1].id == 102 && items[2].id == 202);
+    ymo_assert(items[2].slot == 2);
+    ymo_assert(bsat_shm_scan_idle(&shm, SHM_BASE, items, 1, NULL) == 0);
+
+    for( unsigned int w=0; w<NO_SHM_WORKERS; w++ ) {
+        ymo_assert(shm.lists[w].no_items == NO_SHM_ITEMS - 1);
+    }
+
+    /* A worker which died in the middle of a write is skipped — and we're
+     * told, so we know the result may be missing something: */
+    shm.lists[1].seq++;
+    n = bsat_shm_scan_idle(&shm, INFINITY, items,
+            NO_SHM_WORKERS * NO_SHM_ITEMS, &no_skipped);
+    ymo_assert(no_skipped == 1);
+    ymo_assert(n == 2 * (NO_SHM_ITEMS - 1));
+    ymo_assert(items[0].worker == 0 && items[n - 1].worker == 2);
+    shm.lists[1].seq++;
+    ymo_assert(bsat_shm_scan_idle(&shm, INFINITY, items, 1, &no_skipped)
+            == 1);
+    ymo_assert(no_skipped == 0);
+    bsat_shm_close(&shm);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_shm_attach(void)
+{
+    char path[] = "/tmp/bsat_test_shm_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    ymo_assert(tmp_fd >= 0);
+    close(tmp_fd);
+
+    bsat_shm_t shm;
+    bsat_shm_t other;
+    ymo_assert(bsat_shm_attach(&other, path) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_shm_open(&shm, path, 1, 2) == 0);
+
+    uint32_t slots[3];
+    ymo_assert(bsat_shm_start(&shm, 1, 1, SHM_BASE, &slots[0]) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_shm_start(&shm, 0, 1, SHM_BASE, &slots[0]) == 0);
+    ymo_assert(bsat_shm_start(&shm, 0, 2, SHM_BASE + 1, &slots[1]) == 0);
+    ymo_assert(bsat_shm_start(&shm, 0, 3, SHM_BASE + 2, &slots[2]) == -1);
+    ymo_assert(errno == ENOSPC);
+
+    /* Links are offsets, so a mapping at another address reads the same: */
+    ymo_assert(bsat_shm_attach(&other, path) == 0);
+    ymo_assert(other.header != shm.header);
+    bsat_shm_reset(&shm, 0, slots[0], SHM_BASE + 5);
+
+    bsat_shm_item_t items[2];
+    ymo_assert(bsat_shm_scan_idle(&other, INFINITY, items, 2, NULL) == 2);
+    ymo_assert(items[0].id == 2 && items[1].id == 1);
+    ymo_assert(items[1].tstamp == SHM_BASE + 5);
+
+    /* Freed slots are reused: */
+    bsat_shm_stop(&shm, 0, slots[1]);
+    ymo_assert(bsat_shm_start(&shm, 0, 4, SHM_BASE + 6, &slots[2]) == 0);
+    ymo_assert(slots[2] == slots[1]);
+    ymo_assert(bsat_shm_scan_idle(&other, INFINITY, items, 2, NULL) == 2);
+    ymo_assert(items[0].id == 1 && items[1].id == 4);
+
+    bsat_shm_close(&other);
+    bsat_shm_close(&shm);
+    unlink(path);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_shm_concurrent(void)
+{
+    bsat_shm_t shm;
+    ymo_assert(bsat_shm_open(&shm, NULL, 1, NO_SHM_SLOTS) == 0);
+
+    uint32_t slots[NO_SHM_SLOTS];
+    for( size_t i=0; i<NO_SHM_SLOTS; i++ ) {
+        ymo_assert(bsat_shm_start(&shm, 0, i, SHM_BASE + i, &slots[i]) == 0);
+    }
+
+    /* A worker keeps churning its list while the master scans it: */
+    pid_t pid = fork();
+    ymo_assert(pid >= 0);
+    if( !pid ) {
+        ev_tstamp now = SHM_BASE + NO_SHM_SLOTS;
+        for( size_t i=0; i<200000; i++ ) {
+            size_t idx = i % NO_SHM_SLOTS;
+            if( i % 3 ) {
+                bsat_shm_reset(&shm, 0, slots[idx], now);
+            } else {
+                bsat_shm_stop(&shm, 0, slots[idx]);
+                bsat_shm_start(&shm, 0, idx, now, &slots[idx]);
+            }
+            now += 1.0;
+        }
+        _exit(0);
+    }
+
+    /* Every snapshot is whole: in order, with nothing made up. Stopping and
+     * restarting are two writes, so one may be missing in between. A reader
+     * which keeps losing the race says so, and scans again: */
+    int status = 0;
+    size_t no_scans = 0;
+    size_t no_rescans = 0;
+    size_t no_torn = 0;
+    while( !waitpid(pid, &status, WNOHANG) ) {
+        bsat_shm_item_t items[NO_SHM_SLOTS];
+        unsigned int no_skipped = 0;
+        size_t n = bsat_shm_scan_idle(
+                &shm, INFINITY, items, NO_SHM_SLOTS, &no_skipped);
+        sched_yield();
+        if( no_skipped ) {
+            no_rescans++;
+            continue;
+        }
+
+        no_scans++;
+        if( n < NO_SHM_SLOTS - 1 || !is_ordered(items, n) ) {
+            no_torn++;
+        }
+        for( size_t i=0; i<n; i++ ) {
+            if( items[i].id >= NO_SHM_SLOTS || items[i].slot >= NO_SHM_SLOTS ) {
+                no_torn++;
+            }
+        }
+    }
+    ymo_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ymo_assert(no_scans + no_rescans > 0);
+    ymo_assert(no_torn == 0);
+
+    /* Once the worker's done, nothing is skipped, and everything's there: */
+    bsat_shm_item_t items[NO_SHM_SLOTS];
+    unsigned int no_skipped = 1;
+    ymo_assert(bsat_shm_scan_idle(&shm, INFINITY, items, NO_SHM_SLOTS,
+                &no_skipped) == NO_SHM_SLOTS);
+    ymo_assert(no_skipped == 0);
+    ymo_assert(is_ordered(items, NO_SHM_SLOTS));
+    bsat_shm_close(&shm);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_shm_fork();
+    test_bsat_shm_attach();
+    test_bsat_shm_concurrent();
+    return 0;
+}
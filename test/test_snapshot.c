@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_SNAP_ITEMS 5
+#define KEY_GONE 20
+
+static bsat_timeout_t originals[NO_SNAP_ITEMS];
+static bsat_timeout_t restored[NO_SNAP_ITEMS];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static uint64_t key_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    return (uint64_t)(item - originals) * 10;
+}
+
+
+static bsat_timeout_t* lookup_cb(bsat_toq_t* toq, uint64_t key)
+{
+    /* Pretend one of the connections didn't make it: */
+    if( key == KEY_GONE ) {
+        return NULL;
+    }
+    return &restored[key / 10];
+}
+
+
+static void* take_snapshot(bsat_toq_t* toq, size_t* len)
+{
+    ssize_t needed = bsat_toq_snapshot(toq, key_cb, NULL, 0);
+    ymo_assert(needed == (ssize_t)(sizeof(bsat_snapshot_header_t)
+                + NO_SNAP_ITEMS * sizeof(bsat_snapshot_record_t)));
+
+    void* buf = malloc((size_t)needed);
+    ymo_assert(bsat_toq_snapshot(toq, key_cb, buf, (size_t)needed-1) == -1);
+    ymo_assert(errno == ENOSPC);
+    ymo_assert(bsat_toq_snapshot(toq, key_cb, buf, (size_t)needed) == needed);
+    *len = (size_t)needed;
+    return buf;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_snapshot(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 1.0);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.1, 4) == 0);
+
+    /* Items started later expire later: */
+    for( size_t i=0; i<NO_SNAP_ITEMS; i++ ) {
+        bsat_timeout_init(&originals[i]);
+        bsat_timeout_start(&toq, &originals[i]);
+        ev_sleep(0.002);
+        ev_now_update(loop);
+    }
+
+    size_t len;
+    void* buf = take_snapshot(&toq, &len);
+
+    bsat_snapshot_header_t header;
+    memcpy(&header, buf, sizeof(header));
+    ymo_assert(header.count == NO_SNAP_ITEMS);
+    ymo_assert(header.after == 1.0);
+
+    /* Records come out in deadline order, across all of the lanes: */
+    const bsat_snapshot_record_t* records =
+        (const bsat_snapshot_record_t*)((char*)buf + sizeof(header));
+    for( size_t i=0; i<NO_SNAP_ITEMS; i++ ) {
+        ymo_assert(records[i].remaining > 0.8);
+        ymo_assert(records[i].remaining <= 1.1);
+        if( i ) {
+            ymo_assert(records[i].remaining >= records[i-1].remaining);
+        }
+    }
+
+    bsat_toq_clear(&toq);
+    free(buf);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_restore(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 1.0);
+
+    for( size_t i=0; i<NO_SNAP_ITEMS; i++ ) {
+        bsat_timeout_init(&originals[i]);
+        bsat_timeout_init(&restored[i]);
+        bsat_timeout_start(&toq, &originals[i]);
+        ev_sleep(0.002);
+        ev_now_update(loop);
+    }
+
+    ev_tstamp started[NO_SNAP_ITEMS];
+    for( size_t i=0; i<NO_SNAP_ITEMS; i++ ) {
+        started[i] = originals[i].tstamp;
+    }
+
+    size_t len;
+    void* buf = take_snapshot(&toq, &len);
+    bsat_toq_clear(&toq);
+
+    /* The "new process" queue: */
+    bsat_toq_t next;
+    bsat_toq_init(EV_A_ &next, test_callback, 1.0);
+
+    bsat_timeout_t busy;
+    bsat_timeout_init(&busy);
+    bsat_timeout_start(&next, &busy);
+    ymo_assert(bsat_toq_restore(&next, lookup_cb, buf, len) == -1);
+    ymo_assert(errno == EBUSY);
+    bsat_timeout_stop(&next, &busy);
+
+    ymo_assert(bsat_toq_restore(&next, lookup_cb, buf, len-1) == -1);
+    ymo_assert(errno == EINVAL);
+
+    ymo_assert(bsat_toq_restore(&next, lookup_cb, buf, len)
+            == NO_SNAP_ITEMS-1);
+    ymo_assert(bsat_valid_items(&next) == NO_SNAP_ITEMS-1);
+    ymo_assert(bsat_timeout_is_active(&restored[KEY_GONE/10]) == 0);
+
+    /* Same order, same deadlines: */
+    bsat_timeout_t* cur = next.head;
+    for( size_t i=0; i<NO_SNAP_ITEMS; i++ ) {
+        if( i == KEY_GONE/10 ) {
+            continue;
+        }
+        ymo_assert(cur == &restored[i]);
+        ymo_assert(cur->tstamp - started[i] > -1e-6);
+        ymo_assert(cur->tstamp - started[i] < 1e-6);
+        cur = cur->next;
+    }
+
+    bsat_toq_clear(&next);
+
+    /* Garbage in: */
+    memset(buf, 0, len);
+    ymo_assert(bsat_toq_restore(&next, lookup_cb, buf, len) == -1);
+    ymo_assert(errno == EINVAL);
+
+    free(buf);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_snapshot();
+    test_bsat_restore();
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <errno.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+static size_t no_probes = 0;
+static size_t no_closes = 0;
+static ev_tstamp probed_at = 0.0;
+static ev_tstamp closed_at = 0.0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void stage_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    if( bsat_timeout_is_active(item) ) {
+        ymo_assert(item->stage == 1);
+        no_probes++;
+        probed_at = ev_now(toq->loop);
+    } else {
+        no_closes++;
+        closed_at = ev_now(toq->loop);
+        ev_break(toq->loop, EVBREAK_ALL);
+    }
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_stages_config(void)
+{
+    EV_P = ev_default_loop(0);
+    ev_tstamp bad[] = { 0.1, 0.0 };
+    ev_tstamp good[] = { 0.05, 0.02 };
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stage_cb, 0.1);
+
+    ymo_assert(bsat_toq_set_stages(&toq, bad, 2) == -1);
+    ymo_assert(errno == EINVAL);
+
+    /* Stages and jitter don't mix: */
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.01, 4) == 0);
+    ymo_assert(bsat_toq_set_stages(&toq, good, 2) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.0, 0) == 0);
+
+    ymo_assert(bsat_toq_set_stages(&toq, good, 2) == 0);
+    ymo_assert(toq.after == 0.05);
+    ymo_assert(toq.no_lanes == 2);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.01, 4) == -1);
+
+    /* Can't change stages with items pending: */
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(bsat_toq_set_stages(&toq, good, 2) == -1);
+    ymo_assert(errno == EBUSY);
+    bsat_toq_clear(&toq);
+
+    ymo_assert(bsat_toq_set_stages(&toq, NULL, 0) == 0);
+    ymo_assert(toq.lanes == NULL);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_stages(void)
+{
+    EV_P = ev_default_loop(0);
+    ev_tstamp stages[] = { 0.05, 0.02 };
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, stage_cb, 0.0);
+    ymo_assert(bsat_toq_set_stages(&toq, stages, 2) == 0);
+
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    ymo_assert(bsat_valid_items(&toq.lanes[0]) == 1);
+
+    /* Run through the soft and hard timeouts: */
+    ev_tstamp started = ev_now(loop);
+    ev_run(loop, 0);
+    ymo_assert(no_probes == 1);
+    ymo_assert(no_closes == 1);
+    ymo_assert(probed_at >= started + 0.05);
+    ymo_assert(closed_at >= started + 0.07);
+    ymo_assert(bsat_valid_items(&toq.lanes[0]) == 0);
+    ymo_assert(bsat_valid_items(&toq.lanes[1]) == 0);
+
+    /* Start again and run until the probe: */
+    bsat_timeout_start(&toq, &timeout);
+    while( no_probes < 2 ) {
+        ev_run(loop, EVRUN_ONCE);
+    }
+    ymo_assert(timeout.stage == 1);
+    ymo_assert(bsat_valid_items(&toq.lanes[1]) == 1);
+
+    /* A reset should put it back to stage 0 in a single relink: */
+    bsat_timeout_reset(&toq, &timeout);
+    ymo_assert(timeout.stage == 0);
+    ymo_assert(bsat_valid_items(&toq.lanes[0]) == 1);
+    ymo_assert(bsat_valid_items(&toq.lanes[1]) == 0);
+
+    /* Stopping it in stage 1 works, too: */
+    while( no_probes < 3 ) {
+        ev_run(loop, EVRUN_ONCE);
+    }
+    bsat_timeout_stop(&toq, &timeout);
+    ymo_assert(bsat_valid_items(&toq.lanes[1]) == 0);
+    ymo_assert(no_closes == 1);
+
+    bsat_toq_stop(&toq);
+    bsat_toq_set_stages(&toq, NULL, 0);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_stages_config();
+    test_bsat_stages();
+    return 0;
+}
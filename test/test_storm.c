@@ -0,0 +1,119 @@
+#include "bsat.h"
+#include "bsat_test.h"
+
+#define NO_STORM_TIMEOUTS 20
+#define STORM_BUDGET 3
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+static size_t no_expired = 0;
+static size_t no_storms = 0;
+static size_t last_backlog = 0;
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static void storm_item_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    no_expired++;
+}
+
+
+static void storm_cb(bsat_toq_t* toq, size_t backlog)
+{
+    no_storms++;
+    last_backlog = backlog;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_storm(void)
+{
+    EV_P = ev_default_loop(0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, storm_item_cb, 0.01);
+    bsat_toq_set_storm(&toq, storm_cb, 4.0, STORM_BUDGET);
+
+    /* Start a bunch of timeouts in the same tick: */
+    bsat_timeout_t timeouts[NO_STORM_TIMEOUTS];
+    for( size_t i=0; i<NO_STORM_TIMEOUTS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    /* The first dispatch should expire one budget's worth and report a storm
+     * with the remainder as the backlog: */
+    ev_run(loop, EVRUN_ONCE);
+    ymo_assert(no_expired == STORM_BUDGET);
+    ymo_assert(no_storms == 1);
+    ymo_assert(last_backlog == NO_STORM_TIMEOUTS - STORM_BUDGET);
+    ymo_assert(toq.throttled);
+
+    /* Subsequent iterations each expire at most one budget's worth: */
+    size_t expected = STORM_BUDGET;
+    while( expected < NO_STORM_TIMEOUTS ) {
+        ev_run(loop, EVRUN_ONCE);
+        expected += STORM_BUDGET;
+        if( expected > NO_STORM_TIMEOUTS ) {
+            expected = NO_STORM_TIMEOUTS;
+        }
+        ymo_assert(no_expired == expected);
+    }
+
+    /* Once the backlog drains, we should get the all-clear: */
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(!toq.throttled);
+    ymo_assert(no_storms == 2);
+    ymo_assert(last_backlog == 0);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_no_storm(void)
+{
+    EV_P = ev_default_loop(0);
+    no_expired = no_storms = 0;
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, storm_item_cb, 0.01);
+    bsat_toq_set_storm(&toq, storm_cb, 4.0, STORM_BUDGET);
+
+    /* Batches at or under budget shouldn't trip the detector: */
+    bsat_timeout_t timeouts[STORM_BUDGET];
+    for( size_t i=0; i<STORM_BUDGET; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    ev_run(loop, EVRUN_ONCE);
+    ymo_assert(no_expired == STORM_BUDGET);
+    ymo_assert(no_storms == 0);
+    ymo_assert(!toq.throttled);
+    ymo_assert(toq.expiry_avg > 0.0);
+
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_storm();
+    test_bsat_no_storm();
+    return 0;
+}
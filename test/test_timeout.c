@@ -46,11 +46,148 @@ void test_bsat_timeout(void)
 }
 
 
+void test_bsat_reset_resolution(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 10.0);
+    bsat_toq_set_resolution(&toq, 0.05);
+
+    bsat_timeout_t a;
+    bsat_timeout_t b;
+    bsat_timeout_init(&a);
+    bsat_timeout_init(&b);
+
+    /* Resetting an inactive item always starts it: */
+    bsat_timeout_reset(&toq, &a);
+    bsat_timeout_start(&toq, &b);
+    ymo_assert(bsat_valid_items(&toq) == 2);
+    ymo_assert(toq.no_skipped_resets == 0);
+
+    /* Too soon — nothing moves: */
+    bsat_timeout_reset(&toq, &a);
+    ymo_assert(toq.head == &a);
+    ymo_assert(toq.no_skipped_resets == 1);
+
+    /* Once the resolution has passed, resets relink again: */
+    ev_sleep(0.06);
+    ev_now_update(loop);
+    bsat_timeout_reset(&toq, &a);
+    ymo_assert(toq.head == &b);
+    ymo_assert(toq.tail == &a);
+    ymo_assert(toq.no_skipped_resets == 1);
+
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_deadline_mode(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.05);
+    bsat_toq_set_deadline_mode(&toq, 1);
+
+    bsat_timeout_t a;
+    bsat_timeout_t b;
+    bsat_timeout_init(&a);
+    bsat_timeout_init(&b);
+
+    /* Resetting an inactive item still starts it: */
+    bsat_timeout_reset(&toq, &a);
+    ev_tstamp deadline = a.tstamp + toq.after;
+    ev_sleep(0.01);
+    ev_now_update(loop);
+    bsat_timeout_start(&toq, &b);
+
+    /* ...but activity doesn't push the deadline back: */
+    bsat_timeout_reset(&toq, &a);
+    ymo_assert(toq.head == &a);
+    ymo_assert(toq.tail == &b);
+
+    size_t calls_before = no_calls;
+    ev_run(loop, EVRUN_ONCE);
+    while( no_calls == calls_before ) {
+        ev_run(loop, EVRUN_ONCE);
+    }
+    ymo_assert(last_item == &a);
+    ymo_assert(ev_now(loop) >= deadline);
+    ymo_assert(ev_now(loop) < deadline + 0.01);
+
+    /* Back to regular idle timeouts: */
+    bsat_toq_set_deadline_mode(&toq, 0);
+    bsat_timeout_reset(&toq, &a);
+    bsat_timeout_reset(&toq, &b);
+    ymo_assert(toq.head == &a);
+    ymo_assert(toq.tail == &b);
+
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_batch(void)
+{
+    EV_P = ev_default_loop(0);
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.05);
+
+    bsat_timeout_t timeouts[5];
+    bsat_timeout_t* items[6];
+    for( size_t i=0; i<5; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        items[i] = &timeouts[i];
+    }
+
+    /* Already active items (and duplicates) are skipped: */
+    items[5] = &timeouts[0];
+    bsat_timeout_start(&toq, &timeouts[2]);
+    ymo_assert(bsat_timeout_start_batch(&toq, items, 6) == 4);
+    ymo_assert(bsat_valid_items(&toq) == 5);
+    ymo_assert(toq.head == &timeouts[2]);
+    ymo_assert(toq.tail == &timeouts[4]);
+    ymo_assert(timeouts[0].tstamp == timeouts[4].tstamp);
+    ymo_assert(ev_is_active(&toq.timer));
+
+    ymo_assert(bsat_timeout_stop_batch(&toq, items + 1, 3) == 3);
+    ymo_assert(bsat_valid_items(&toq) == 2);
+    ymo_assert(toq.head == &timeouts[0]);
+    ymo_assert(toq.tail == &timeouts[4]);
+    ymo_assert(bsat_timeout_stop_batch(&toq, items + 1, 3) == 0);
+
+    /* Lanes are scheduled once, too: */
+    bsat_toq_clear(&toq);
+    ymo_assert(bsat_toq_set_jitter(&toq, 0.01, 4) == 0);
+    ymo_assert(bsat_timeout_start_batch(&toq, items, 5) == 5);
+    size_t no_items = 0;
+    for( unsigned int i=0; i<toq.no_lanes; i++ ) {
+        no_items += bsat_valid_items(&toq.lanes[i]);
+    }
+    ymo_assert(no_items == 5);
+    ymo_assert(ev_is_active(&toq.timer));
+
+    ymo_assert(bsat_timeout_stop_batch(&toq, items, 5) == 5);
+    bsat_toq_clear(&toq);
+    bsat_toq_set_jitter(&toq, 0.0, 0);
+
+    /* Cool! */
+    return;
+}
+
+
 /*-------------------------------------------------------------*
  * Main:
  *-------------------------------------------------------------*/
 int main(int argc, char** argv)
 {
     test_bsat_timeout();
+    test_bsat_reset_resolution();
+    test_bsat_deadline_mode();
+    test_bsat_batch();
     return 0;
 }
@@ -79,6 +79,55 @@ void test_bsat_order(void)
 }
 
 
+void test_bsat_move(void)
+{
+    struct ev_loop* loop = ev_default_loop(0);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.01);
+
+    bsat_timeout_t timeouts[3];
+    bsat_timeout_t moved;
+    bsat_timeout_init(&moved);
+    for( size_t i=0; i<3; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+    }
+
+    /* Moving an item should keep its position and deadline: */
+    ev_tstamp tstamp = timeouts[1].tstamp;
+    bsat_timeout_move(&toq, &moved, &timeouts[1]);
+    ymo_assert(bsat_valid_items(&toq) == 3);
+    ymo_assert(!bsat_timeout_is_active(&timeouts[1]));
+    ymo_assert(moved.tstamp == tstamp);
+    ymo_assert(toq.head->next == &moved);
+    ymo_assert(moved.next == &timeouts[2]);
+
+    /* ...including at either end of the queue: */
+    bsat_timeout_move(&toq, &timeouts[1], &timeouts[0]);
+    ymo_assert(toq.head == &timeouts[1]);
+    bsat_timeout_move(&toq, &timeouts[0], &timeouts[2]);
+    ymo_assert(toq.tail == &timeouts[0]);
+    ymo_assert(bsat_valid_items(&toq) == 3);
+
+    /* Moving an inactive item is a no-op: */
+    bsat_timeout_move(&toq, &timeouts[2], &timeouts[2]);
+    ymo_assert(bsat_valid_items(&toq) == 3);
+
+    /* ...and so is moving an active item onto itself: */
+    bsat_timeout_move(&toq, &moved, &moved);
+    ymo_assert(bsat_timeout_is_active(&moved));
+    ymo_assert(moved.tstamp == tstamp);
+    ymo_assert(toq.head == &timeouts[1] && timeouts[1].next == &moved);
+    ymo_assert(bsat_valid_items(&toq) == 3);
+
+    bsat_toq_clear(&toq);
+    bsat_toq_stop(&toq);
+    /* Cool! */
+    return;
+}
+
+
 /*-------------------------------------------------------------*
  * Main:
  *-------------------------------------------------------------*/
@@ -86,5 +135,6 @@ int main(int argc, char** argv)
 {
     test_bsat_toq();
     test_bsat_order();
+    test_bsat_move();
     return 0;
 }
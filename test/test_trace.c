@@ -0,0 +1,140 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "bsat.h"
+#include "bsat_test.h"
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_trace(void)
+{
+    EV_P = ev_default_loop(0);
+    char path[] = "/tmp/bsat_test_trace_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    ymo_assert(tmp_fd >= 0);
+    close(tmp_fd);
+
+    /* Create a TOQ and start tracing it: */
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.01);
+    ymo_assert(bsat_toq_trace_open(&toq, path, 8) == 0);
+
+    bsat_timeout_t timeouts[2];
+    bsat_timeout_init(&timeouts[0]);
+    bsat_timeout_init(&timeouts[1]);
+
+    /* start, start, reset, stop, expire: */
+    bsat_timeout_start(&toq, &timeouts[0]);
+    bsat_timeout_start(&toq, &timeouts[1]);
+    bsat_timeout_reset(&toq, &timeouts[0]);
+    bsat_timeout_stop(&toq, &timeouts[1]);
+    ev_run(loop, 0);
+    ymo_assert(no_calls == 1);
+    ymo_assert(last_item == &timeouts[0]);
+
+    /* No-op operations shouldn't be recorded: */
+    bsat_timeout_stop(&toq, &timeouts[1]);
+    ymo_assert(toq.trace->count == 5);
+
+    /* Changing the period should be reflected in the header, so replays use
+     * the one that's in effect: */
+    ymo_assert(bsat_toq_set_after(&toq, 0.02, 0) == 0);
+    ymo_assert(toq.trace->after == 0.02);
+    bsat_toq_trace_close(&toq);
+    ymo_assert(toq.trace == NULL);
+
+    /* Now, read the trace back in and make sure it's what we expect: */
+    int fd = open(path, O_RDONLY);
+    ymo_assert(fd >= 0);
+    struct stat st;
+    ymo_assert(fstat(fd, &st) == 0);
+    ymo_assert((size_t)st.st_size ==
+            sizeof(bsat_trace_header_t) + 8 * sizeof(bsat_trace_event_t));
+
+    bsat_trace_header_t* trace = mmap(
+            NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ymo_assert(trace != MAP_FAILED);
+    ymo_assert(memcmp(trace->magic, BSAT_TRACE_MAGIC, 8) == 0);
+    ymo_assert(trace->version == BSAT_TRACE_VERSION);
+    ymo_assert(trace->capacity == 8);
+    ymo_assert(trace->count == 5);
+    ymo_assert(trace->after == 0.02);
+
+    bsat_trace_event_t* events = (bsat_trace_event_t*)(trace + 1);
+    uint32_t types[] = {
+        BSAT_TRACE_START, BSAT_TRACE_START, BSAT_TRACE_RESET,
+        BSAT_TRACE_STOP, BSAT_TRACE_EXPIRE,
+    };
+    bsat_timeout_t* items[] = {
+        &timeouts[0], &timeouts[1], &timeouts[0], &timeouts[1], &timeouts[0],
+    };
+
+    for( size_t i=0; i<5; i++ ) {
+        ymo_assert(events[i].type == types[i]);
+        ymo_assert(events[i].item == (uint64_t)(uintptr_t)items[i]);
+        ymo_assert(events[i].tstamp > 0.0);
+    }
+    ymo_assert(events[4].tstamp >= events[0].tstamp + 0.01);
+
+    munmap(trace, st.st_size);
+    close(fd);
+    unlink(path);
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_trace_wrap(void)
+{
+    EV_P = ev_default_loop(0);
+    char path[] = "/tmp/bsat_test_trace_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    ymo_assert(tmp_fd >= 0);
+    close(tmp_fd);
+
+    bsat_toq_t toq;
+    bsat_toq_init(EV_A_ &toq, test_callback, 0.01);
+    ymo_assert(bsat_toq_trace_open(&toq, path, 0) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_trace_open(&toq, path, 4) == 0);
+
+    /* Record more events than the ring can hold: */
+    bsat_timeout_t timeout;
+    bsat_timeout_init(&timeout);
+    bsat_timeout_start(&toq, &timeout);
+    for( size_t i=0; i<9; i++ ) {
+        bsat_timeout_reset(&toq, &timeout);
+    }
+    bsat_timeout_stop(&toq, &timeout);
+
+    /* The newest event overwrites the oldest: */
+    bsat_trace_event_t* events = (bsat_trace_event_t*)(toq.trace + 1);
+    ymo_assert(toq.trace->count == 11);
+    ymo_assert(events[10 % 4].type == BSAT_TRACE_STOP);
+    ymo_assert(events[9 % 4].type == BSAT_TRACE_RESET);
+
+    bsat_toq_trace_close(&toq);
+    unlink(path);
+    bsat_toq_stop(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    test_bsat_trace();
+    test_bsat_trace_wrap();
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsat_config.h"
+#include "bsat.h"
+#include "bsat_test.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+/*-------------------------------------------------------------*
+ * Hacky globals:
+ *-------------------------------------------------------------*/
+#define NO_URING_ITEMS 5
+#define URING_AFTER 0.02
+#define URING_TAG 0xb5a7ULL
+
+/* Just enough of a ring to drive the queue, without liburing: */
+typedef struct test_ring {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned to_submit;
+} test_ring_t;
+
+static test_ring_t ring;
+static size_t no_timeouts = 0;
+static size_t no_updates = 0;
+static size_t no_removes = 0;
+static size_t no_uring_expired = 0;
+static ev_tstamp max_lateness = 0.0;
+static ev_tstamp deadlines[NO_URING_ITEMS];
+static bsat_timeout_t timeouts[NO_URING_ITEMS];
+
+
+/*-------------------------------------------------------------*
+ * Hacky utility functions:
+ *-------------------------------------------------------------*/
+static int ring_init(test_ring_t* r)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->fd = (int)syscall(__NR_io_uring_setup, 16, &params);
+    if( r->fd < 0 ) {
+        return -1;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    char* sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+            r->fd, IORING_OFF_SQ_RING);
+    char* cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+            r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if( sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED ) {
+        return -1;
+    }
+
+    r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + params.sq_off.array);
+    r->cq_head = (unsigned*)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    r->to_submit = 0;
+    return 0;
+}
+
+
+static struct io_uring_sqe* get_sqe(bsat_toq_t* toq)
+{
+    unsigned tail = *ring.sq_tail;
+    unsigned idx = tail & *ring.sq_mask;
+    ring.sq_array[idx] = idx;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    return &ring.sqes[idx];
+}
+
+
+/* Submit whatever the queue prepared, wait for a completion, and hand our
+ * completions back to the queue: */
+static void ring_run_once(bsat_toq_t* toq)
+{
+    /* Tally up what we're submitting: */
+    unsigned tail = *ring.sq_tail;
+    for( unsigned i=tail - ring.to_submit; i != tail; i++ ) {
+        struct io_uring_sqe* sqe = &ring.sqes[i & *ring.sq_mask];
+        if( sqe->opcode == IORING_OP_TIMEOUT ) {
+            no_timeouts++;
+        } else if( sqe->timeout_flags & IORING_TIMEOUT_UPDATE ) {
+            no_updates++;
+        } else {
+            no_removes++;
+        }
+    }
+
+    int rc = (int)syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+    ymo_assert(rc >= 0);
+    ring.to_submit = 0;
+
+    unsigned head = *ring.cq_head;
+    while( head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) ) {
+        struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+        __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+        ymo_assert(cqe->user_data == URING_TAG);
+        bsat_toq_uring_complete(toq, cqe->res);
+    }
+}
+
+
+static ev_tstamp mono_clock(bsat_toq_t* toq)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void uring_cb(bsat_toq_t* toq, bsat_timeout_t* item)
+{
+    ev_tstamp lateness = mono_clock(toq) - deadlines[item - timeouts];
+    if( lateness > max_lateness ) {
+        max_lateness = lateness;
+    }
+    no_uring_expired++;
+}
+
+
+/*-------------------------------------------------------------*
+ * Tests:
+ *-------------------------------------------------------------*/
+void test_bsat_uring(void)
+{
+    /* No libev loop required: */
+    bsat_toq_t toq;
+    bsat_toq_init(NULL, &toq, uring_cb, URING_AFTER);
+    ymo_assert(bsat_toq_set_uring(&toq, NULL, mono_clock, URING_TAG) == -1);
+    ymo_assert(errno == EINVAL);
+    ymo_assert(bsat_toq_set_uring(&toq, get_sqe, mono_clock, URING_TAG) == 0);
+
+    /* One timeout SQE for the whole queue: */
+    for( size_t i=0; i<NO_URING_ITEMS; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+        bsat_timeout_start(&toq, &timeouts[i]);
+        deadlines[i] = timeouts[i].tstamp + URING_AFTER;
+    }
+    ymo_assert(ring.to_submit == 1);
+
+    /* Items come and go without touching it: */
+    bsat_timeout_stop(&toq, &timeouts[0]);
+    bsat_timeout_reset(&toq, &timeouts[0]);
+    deadlines[0] = timeouts[0].tstamp + URING_AFTER;
+    bsat_timeout_reset(&toq, &timeouts[1]);
+    deadlines[1] = timeouts[1].tstamp + URING_AFTER;
+
+    while( no_uring_expired < NO_URING_ITEMS ) {
+        ring_run_once(&toq);
+    }
+    ymo_assert(bsat_valid_items(&toq) == 0);
+    ymo_assert(no_timeouts >= 1);
+    ymo_assert(max_lateness >= 0.0);
+    ymo_assert(max_lateness < URING_AFTER);
+
+    /* Stopping cancels the timeout — nothing expires afterwards: */
+    no_uring_expired = 0;
+    bsat_timeout_start(&toq, &timeouts[0]);
+    bsat_toq_stop(&toq);
+    ymo_assert(no_removes == 0);
+    ring_run_once(&toq);
+    ymo_assert(no_removes == 1);
+    ymo_assert(no_uring_expired == 0);
+    bsat_toq_clear(&toq);
+
+    /* Cool! */
+    return;
+}
+
+
+void test_bsat_uring_update(void)
+{
+    bsat_toq_t toq;
+    bsat_toq_init(NULL, &toq, uring_cb, 10.0);
+    ymo_assert(bsat_toq_set_uring(&toq, get_sqe, mono_clock, URING_TAG) == 0);
+    no_timeouts = no_updates = no_removes = 0;
+
+    /* While a timeout is pending, the next one moves it rather than adding
+     * another: */
+    bsat_timeout_init(&timeouts[0]);
+    bsat_timeout_init(&timeouts[1]);
+    bsat_timeout_start(&toq, &timeouts[0]);
+    for( size_t i=0; i<3; i++ ) {
+        bsat_timeout_stop(&toq, &timeouts[0]);
+        bsat_timeout_start(&toq, &timeouts[0]);
+    }
+
+    /* Starting over while it's being cancelled waits for the cancellation: */
+    bsat_toq_clear(&toq);
+    bsat_timeout_start(&toq, &timeouts[1]);
+    ymo_assert(ring.to_submit == 5);
+    ring_run_once(&toq);
+    ymo_assert(no_timeouts == 1);
+    ymo_assert(no_updates == 3);
+    ymo_assert(no_removes == 1);
+    ymo_assert(ring.to_submit == 1);
+
+    bsat_toq_clear(&toq);
+    ring_run_once(&toq);
+    ymo_assert(no_timeouts == 2);
+    ymo_assert(no_removes == 2);
+
+    /* Every timeout and update counts as arming the timer: */
+    ymo_assert(toq.no_timer_arms == no_timeouts + no_updates);
+
+    /* Cool! */
+    return;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+
+/*-------------------------------------------------------------*
+ * Main:
+ *-------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    if( ring_init(&ring) ) {
+        fprintf(stderr, "io_uring unavailable (%s); skipping\n",
+                strerror(errno));
+        return 0;
+    }
+
+    test_bsat_uring();
+    test_bsat_uring_update();
+#endif /* HAVE_LINUX_IO_URING_H */
+    return 0;
+}
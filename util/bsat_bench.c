@@ -0,0 +1,445 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # bsat-bench
+ *
+ * `bsat-bench` measures the cost of `bsat_timeout_reset` on a stream of
+ * small packets spread over many connections — first with every reset
+ * relinking, then with a reset resolution (see `bsat_toq_set_resolution`) —
+ * and then of expiring every connection through `bsat_toq_dispatch`.
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C util bsat-bench
+ *
+ * # 10k connections, 4k packets per 1ms loop iteration, 30s idle timeout,
+ * # 50ms reset resolution:
+ * ./util/bsat-bench -n 10000 -b 4000 -t 0.001 -a 30 -r 0.05
+ *
+ * # dTLB misses with 5M connections, before and after huge pages:
+ * ./util/bsat-bench -n 5000000 -m malloc
+ * ./util/bsat-bench -n 5000000 -m thp
+ * ```
+ *
+ * ## Options
+ *
+ *  - `-n CONNS`: number of connections (default: `10000`)
+ *  - `-p PACKETS`: total number of packets (default: `4000000`)
+ *  - `-b BATCH`: packets per loop iteration (default: `4000`)
+ *  - `-t TICK`: time between loop iterations, in seconds (default: `0.001`)
+ *  - `-a AFTER`: idle timeout (default: `30`)
+ *  - `-r RESOLUTION`: reset resolution to compare against (default: `0.05`)
+ *  - `-m BACKING`: where the connections live: `malloc`, or a `bsat_pool_t`
+ *    on the local NUMA node with ordinary pages (`pool`), transparent huge
+ *    pages (`thp`), or explicit huge pages (`hugetlb`) (default: `malloc`)
+ *
+ * ## Mechanics
+ *
+ * Each packet resets the timeout of a (pseudo-)randomly chosen connection.
+ * Packets are delivered in batches, one per loop iteration; between
+ * iterations, the benchmark sleeps for `TICK` seconds and updates `ev_now`,
+ * so that time moves on at a realistic pace. Only the time spent resetting
+ * is measured. Each connection is 512 bytes, of which the timeout is a
+ * small part.
+ *
+ * Afterwards, the queue's clock jumps past the idle timeout and every
+ * connection expires, with the callback touching each one as a server
+ * would.
+ *
+ * Where the CPU exposes them (see `perf_event_open(2)`), dTLB load misses
+ * are counted over the same spans as the timings; otherwise, they're
+ * reported as `-`.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <ev.h>
+
+#include "bsat.h"
+
+
+/*----------------------*
+ *        Types:
+ *----------------------*/
+typedef struct bench_config {
+    size_t     no_conns;
+    size_t     no_packets;
+    size_t     batch;
+    ev_tstamp  tick;
+    ev_tstamp  after;
+    ev_tstamp  resolution;
+    int        backing;     /* BSAT_POOL_* flags, or -1 for malloc */
+} bench_config_t;
+
+typedef struct bench_result {
+    double     elapsed;
+    uint64_t   no_skipped;
+    uint64_t   dtlb_misses;
+    double     expire_elapsed;
+    uint64_t   expire_dtlb_misses;
+    size_t     no_expired;
+    int        backing;
+} bench_result_t;
+
+/* Something like a real connection — the timeout is a small part of it: */
+typedef struct bench_conn {
+    bsat_timeout_t timeout;
+    uint64_t no_expired;
+    char state[448];
+} bench_conn_t;
+
+static int dtlb_fd = -1;
+static int expiring = 0;
+static ev_tstamp fake_now = 0.0;
+
+
+/*----------------------*
+ *      Utilities:
+ *----------------------*/
+static double bench_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static uint64_t bench_rand(uint64_t* state)
+{
+    /* xorshift64: cheap enough not to skew the measurement */
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+
+/* Count dTLB load misses in this thread, if the CPU will tell us: */
+static void bench_dtlb_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    dtlb_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static void bench_dtlb_start(void)
+{
+    if( dtlb_fd >= 0 ) {
+        ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+static void bench_dtlb_stop(uint64_t* misses)
+{
+    uint64_t count = 0;
+    if( dtlb_fd >= 0 ) {
+        ioctl(dtlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if( read(dtlb_fd, &count, sizeof(count)) == sizeof(count) ) {
+            *misses += count;
+        }
+        ioctl(dtlb_fd, PERF_EVENT_IOC_RESET, 0);
+    }
+}
+
+
+static ev_tstamp fake_clock(bsat_toq_t* toq)
+{
+    return fake_now;
+}
+
+
+static void fake_schedule(bsat_toq_t* toq, ev_tstamp delay)
+{
+    return;
+}
+
+
+static void bench_expired(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    /* Nothing should expire until we say so: */
+    if( !expiring ) {
+        fprintf(stderr, "WARNING: a timeout expired (is -a too short?)\n");
+    }
+
+    bench_conn_t* conn = timeout->data;
+    conn->no_expired++;
+}
+
+
+/* Allocate the connections as configured (see -m): */
+static bench_conn_t* bench_conns_alloc(
+        const bench_config_t* config, bsat_pool_t* pool, int* backing)
+{
+    if( config->backing < 0 ) {
+        *backing = -1;
+        return calloc(config->no_conns, sizeof(bench_conn_t));
+    }
+
+    if( bsat_pool_open(pool, sizeof(bench_conn_t), config->no_conns,
+                config->backing | BSAT_POOL_NUMA_LOCAL) ) {
+        return NULL;
+    }
+
+    /* The pool hands out consecutive items, just like the array: */
+    bench_conn_t* conns = bsat_pool_alloc(pool);
+    for( size_t i=1; i<config->no_conns; i++ ) {
+        bsat_pool_alloc(pool);
+    }
+    *backing = pool->backing;
+    return conns;
+}
+
+
+/*----------------------*
+ *      Benchmarks:
+ *----------------------*/
+static int bench_reset(
+        struct ev_loop* loop,
+        const bench_config_t* config,
+        ev_tstamp resolution,
+        bench_result_t* result)
+{
+    bsat_pool_t pool;
+    bench_conn_t* conns = bench_conns_alloc(config, &pool, &result->backing);
+    if( !conns ) {
+        perror("Unable to allocate connections");
+        return -1;
+    }
+
+    bsat_toq_t toq;
+    bsat_toq_init(loop, &toq, bench_expired, config->after);
+    bsat_toq_set_resolution(&toq, resolution);
+
+    ev_now_update(loop);
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        bsat_timeout_init(&conns[i].timeout);
+        conns[i].timeout.data = &conns[i];
+        bsat_timeout_start(&toq, &conns[i].timeout);
+    }
+
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    double elapsed = 0.0;
+    size_t remaining = config->no_packets;
+    result->dtlb_misses = 0;
+    while( remaining ) {
+        size_t batch = remaining < config->batch ? remaining : config->batch;
+        remaining -= batch;
+
+        double started = bench_clock();
+        bench_dtlb_start();
+        while( batch-- ) {
+            size_t idx = (size_t)(bench_rand(&rng) % config->no_conns);
+            bsat_timeout_reset(&toq, &conns[idx].timeout);
+        }
+        bench_dtlb_stop(&result->dtlb_misses);
+        elapsed += bench_clock() - started;
+
+        ev_sleep(config->tick);
+        ev_now_update(loop);
+    }
+
+    result->elapsed = elapsed;
+    result->no_skipped = toq.no_skipped_resets;
+
+    /* Jump past the idle timeout, and dispatch everything: */
+    fake_now = ev_now(loop) + config->after + 1.0;
+    bsat_toq_set_scheduler(&toq, fake_schedule, fake_clock);
+    expiring = 1;
+    result->expire_dtlb_misses = 0;
+    double started = bench_clock();
+    bench_dtlb_start();
+    bsat_toq_expire_due(&toq);
+    bench_dtlb_stop(&result->expire_dtlb_misses);
+    result->expire_elapsed = bench_clock() - started;
+    expiring = 0;
+
+    result->no_expired = 0;
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        result->no_expired += conns[i].no_expired;
+    }
+
+    bsat_toq_set_scheduler(&toq, NULL, NULL);
+    bsat_toq_clear(&toq);
+    if( config->backing < 0 ) {
+        free(conns);
+    } else {
+        bsat_pool_close(&pool);
+    }
+    return 0;
+}
+
+
+static void bench_report(
+        const char* label,
+        const bench_config_t* config,
+        const bench_result_t* result)
+{
+    char dtlb[32] = "-";
+    if( dtlb_fd >= 0 ) {
+        snprintf(dtlb, sizeof(dtlb), "%.3f",
+                (double)result->dtlb_misses / config->no_packets);
+    }
+    printf("%-18s %8.2f ns/reset %8.2f Mresets/s  %5.1f%% skipped"
+            "  %s dTLB/reset\n",
+            label,
+            result->elapsed * 1e9 / config->no_packets,
+            config->no_packets / result->elapsed / 1e6,
+            100.0 * result->no_skipped / config->no_packets,
+            dtlb);
+}
+
+
+static void bench_report_expiry(const bench_result_t* result)
+{
+    char dtlb[32] = "-";
+    if( dtlb_fd >= 0 ) {
+        snprintf(dtlb, sizeof(dtlb), "%.3f",
+                (double)result->expire_dtlb_misses / result->no_expired);
+    }
+    printf("%-18s %8.2f ns/expiry %7.2f Mexpiries/s  %s dTLB/expiry\n",
+            "expiry",
+            result->expire_elapsed * 1e9 / result->no_expired,
+            result->no_expired / result->expire_elapsed / 1e6,
+            dtlb);
+}
+
+
+static const char* bench_backing_name(int backing)
+{
+    if( backing < 0 ) {
+        return "malloc";
+    } else if( backing & BSAT_POOL_HUGETLB ) {
+        return "pool, hugetlb";
+    } else if( backing & BSAT_POOL_THP ) {
+        return "pool, thp";
+    }
+    return "pool";
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n CONNS] [-p PACKETS] [-b BATCH] [-t TICK]\n"
+            "          [-a AFTER] [-r RESOLUTION]"
+            " [-m malloc|pool|thp|hugetlb]\n", prog);
+    exit(1);
+}
+
+
+/*----------------------*
+ *        Main:
+ *----------------------*/
+int main(int argc, char** argv)
+{
+    bench_config_t config = {
+        .no_conns = 10000,
+        .no_packets = 4000000,
+        .batch = 4000,
+        .tick = 0.001,
+        .after = 30.0,
+        .resolution = 0.05,
+        .backing = -1,
+    };
+
+    int opt;
+    while( (opt = getopt(argc, argv, "n:p:b:t:a:r:m:")) != -1 ) {
+        switch( opt ) {
+            case 'n': config.no_conns = strtoul(optarg, NULL, 10); break;
+            case 'p': config.no_packets = strtoul(optarg, NULL, 10); break;
+            case 'b': config.batch = strtoul(optarg, NULL, 10); break;
+            case 't': config.tick = strtod(optarg, NULL); break;
+            case 'a': config.after = strtod(optarg, NULL); break;
+            case 'r': config.resolution = strtod(optarg, NULL); break;
+            case 'm':
+                if( !strcmp(optarg, "malloc") ) {
+                    config.backing = -1;
+                } else if( !strcmp(optarg, "pool") ) {
+                    config.backing = 0;
+                } else if( !strcmp(optarg, "thp") ) {
+                    config.backing = BSAT_POOL_THP;
+                } else if( !strcmp(optarg, "hugetlb") ) {
+                    config.backing = BSAT_POOL_HUGETLB;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( !config.no_conns || !config.no_packets || !config.batch
+            || config.after <= 0.0 ) {
+        usage(argv[0]);
+    }
+
+    struct ev_loop* loop = ev_default_loop(0);
+    bench_dtlb_open();
+    printf("bsat-bench (%s): %zu packets over %zu connections, "
+            "%zu per %gs tick\n",
+            BSAT_VERSION_STR, config.no_packets, config.no_conns,
+            config.batch, config.tick);
+
+    bench_result_t base;
+    bench_result_t rated;
+    if( bench_reset(loop, &config, 0.0, &base)
+            || bench_reset(loop, &config, config.resolution, &rated) ) {
+        return 1;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "resolution=%gs", config.resolution);
+    bench_report("resolution=0", &config, &base);
+    bench_report(label, &config, &rated);
+    printf("speedup: %.2fx\n", base.elapsed / rated.elapsed);
+    bench_report_expiry(&rated);
+
+    /* Whatever took effect, which may be less than was asked for: */
+    printf("backing: %s", bench_backing_name(rated.backing));
+    if( rated.backing >= 0 && (rated.backing & BSAT_POOL_NUMA_LOCAL) ) {
+        printf(", NUMA-local");
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,725 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # bsat-replay
+ *
+ * `bsat-replay` replays a trace recorded with `bsat_toq_trace_open` against
+ * a fresh timeout queue, so that queue settings can be tuned using real
+ * traffic rather than guesswork.
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C util bsat-replay
+ *
+ * # replay a trace at 10x speed with a 5 second timeout:
+ * ./util/bsat-replay -x 10 -a 5 /var/tmp/idle.trace
+ * ```
+ *
+ * ## Options
+ *
+ *  - `-a AFTER`: timeout period to replay with (default: the traced value)
+ *  - `-x SPEED`: time compression factor (default: `1.0`, i.e. real time)
+ *  - `-b BUDGET`: enable storm detection with the given dispatch budget
+ *    (see `bsat_toq_set_storm`)
+ *  - `-f FACTOR`: storm detection factor (default: `8.0`; requires `-b`)
+ *  - `-j JITTER`: spread deadlines by up to `JITTER` seconds
+ *    (see `bsat_toq_set_jitter`)
+ *  - `-s SLACK`: run the queue in adaptive mode, letting its timer go off up
+ *    to `SLACK` seconds late (see `bsat_toq_set_adaptive`)
+ *  - `-B BACKEND`: what drives the queue's timer (default: `ev`):
+ *     - `ev`: the queue's own `ev_timer`
+ *     - `uring`: an `IORING_OP_TIMEOUT` on a private io_uring, whose
+ *       completions are picked up by the loop (see `bsat_toq_set_uring`)
+ *     - `scheduler`: a separate `ev_timer`, standing in for another event
+ *       loop's timer (see `bsat_toq_set_scheduler`)
+ *     - `service`: a timer service thread, which wakes the loop when the
+ *       queue is due (see `bsat_service_add`)
+ *
+ * ## Mechanics
+ *
+ * Start, reset, and stop events are re-issued against the queue at their
+ * original (scaled) offsets, using a single `ev_timer` to pace the feed.
+ * Recorded expirations are _not_ replayed — they're what we're simulating —
+ * but they're counted, so the report can compare the two.
+ *
+ * Once the feed is exhausted and the queue drains, a report is printed with:
+ *  - the number of expirations observed in the trace and in the replay
+ *  - expiry lateness (how long after its deadline each callback ran),
+ *    expressed in _trace_ time
+ *  - the number of times the queue's timer was (re)armed
+ *  - CPU time consumed by the replay
+ *
+ * > **NOTE**: if the trace ring wrapped, the oldest events are gone. Resets
+ * > and stops for items whose start was lost are treated as starts and
+ * > ignored, respectively.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <ev.h>
+
+#include "bsat_config.h"
+#include "bsat.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* user_data of the queue's io_uring SQEs: */
+#define REPLAY_URING_TAG 0xb5a7ULL
+
+
+/*--------------------------------------------------
+ * Types:
+ *--------------------------------------------------*/
+
+/* A traced item, as seen by the replay: */
+typedef struct replay_item {
+    uint64_t       id;
+    bsat_timeout_t timeout;
+    ev_tstamp      deadline;
+} replay_item_t;
+
+/* Open-addressed map of trace item ID to replay item: */
+typedef struct replay_map {
+    replay_item_t** slots;
+    size_t          capacity;
+    size_t          no_items;
+} replay_map_t;
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Just enough of an io_uring to drive the queue, without liburing: */
+typedef struct replay_ring {
+    int                  fd;
+    unsigned             no_entries;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned             to_submit;
+    ev_io                io;
+    ev_prepare           submit;
+} replay_ring_t;
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* Overall replay state: */
+typedef struct replay {
+    struct ev_loop*     loop;
+    bsat_toq_t          toq;
+    ev_timer            feed;
+    replay_map_t        items;
+
+    bsat_trace_event_t* events;
+    size_t              no_events;
+    size_t              next_event;
+    size_t              no_pending;
+    ev_tstamp           trace_start;
+    ev_tstamp           replay_start;
+    ev_tstamp           speed;
+    ev_tstamp           after;
+    size_t              budget;
+    double              factor;
+    ev_tstamp           jitter;
+    ev_tstamp           slack;
+    const char*         backend;
+    ev_timer            scheduler;
+    bsat_service_t      service;
+#ifdef HAVE_LINUX_IO_URING_H
+    replay_ring_t       ring;
+#endif /* HAVE_LINUX_IO_URING_H */
+
+    size_t              no_by_type[BSAT_TRACE_EXPIRE+1];
+    size_t              no_expired;
+    ev_tstamp           lateness_sum;
+    ev_tstamp           lateness_max;
+    size_t              no_storms;
+    size_t              max_backlog;
+} replay_t;
+
+
+/*--------------------------------------------------
+ * Item map:
+ *--------------------------------------------------*/
+static size_t replay_map_slot(replay_map_t* map, uint64_t id)
+{
+    /* Item IDs are addresses, so the low bits are mostly alignment: */
+    uint64_t hash = id * 0x9e3779b97f4a7c15ULL;
+    size_t idx = (size_t)(hash >> 32) & (map->capacity - 1);
+    while( map->slots[idx] && map->slots[idx]->id != id ) {
+        idx = (idx + 1) & (map->capacity - 1);
+    }
+    return idx;
+}
+
+
+static int replay_map_grow(replay_map_t* map)
+{
+    replay_map_t grown = {
+        .capacity = map->capacity ? map->capacity * 2 : 1024,
+        .no_items = map->no_items,
+    };
+
+    grown.slots = calloc(grown.capacity, sizeof(replay_item_t*));
+    if( !grown.slots ) {
+        return -1;
+    }
+
+    for( size_t i=0; i<map->capacity; i++ ) {
+        if( map->slots[i] ) {
+            grown.slots[replay_map_slot(&grown, map->slots[i]->id)] =
+                map->slots[i];
+        }
+    }
+
+    free(map->slots);
+    *map = grown;
+    return 0;
+}
+
+
+static replay_item_t* replay_map_get(replay_map_t* map, uint64_t id, int add)
+{
+    if( map->capacity ) {
+        replay_item_t* item = map->slots[replay_map_slot(map, id)];
+        if( item || !add ) {
+            return item;
+        }
+    } else if( !add ) {
+        return NULL;
+    }
+
+    if( (map->no_items + 1) * 2 > map->capacity && replay_map_grow(map) ) {
+        return NULL;
+    }
+
+    replay_item_t* item = malloc(sizeof(replay_item_t));
+    if( !item ) {
+        return NULL;
+    }
+
+    item->id = id;
+    item->deadline = -1.0;
+    bsat_timeout_init(&item->timeout);
+    item->timeout.data = item;
+    map->slots[replay_map_slot(map, id)] = item;
+    map->no_items++;
+    return item;
+}
+
+
+/*--------------------------------------------------
+ * Backends:
+ *--------------------------------------------------*/
+static ev_tstamp replay_clock(bsat_toq_t* toq)
+{
+    replay_t* replay = toq->data;
+    return ev_now(replay->loop);
+}
+
+
+/* As another loop's timer would, via bsat_toq_set_scheduler: */
+static void replay_schedule(bsat_toq_t* toq, ev_tstamp delay)
+{
+    replay_t* replay = toq->data;
+    ev_timer_stop(replay->loop, &replay->scheduler);
+    if( delay >= 0.0 ) {
+        ev_timer_set(&replay->scheduler, delay, 0.0);
+        ev_timer_start(replay->loop, &replay->scheduler);
+    }
+    return;
+}
+
+
+static void replay_scheduled(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    replay_t* replay = w->data;
+    bsat_toq_expire_due(&replay->toq);
+    return;
+}
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+static int replay_ring_enter(replay_ring_t* ring)
+{
+    int rc = (int)syscall(
+            __NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0, NULL, 0);
+    if( rc < 0 ) {
+        return -1;
+    }
+
+    ring->to_submit -= (unsigned)rc;
+    return 0;
+}
+
+
+static struct io_uring_sqe* replay_ring_get_sqe(bsat_toq_t* toq)
+{
+    replay_ring_t* ring = &((replay_t*)toq->data)->ring;
+    if( ring->to_submit == ring->no_entries && replay_ring_enter(ring) ) {
+        return NULL;
+    }
+
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return &ring->sqes[idx];
+}
+
+
+/* Submit whatever the queue prepared before the loop goes to sleep: */
+static void replay_ring_submit(struct ev_loop* loop, ev_prepare* w, int revents)
+{
+    replay_ring_t* ring = w->data;
+    if( ring->to_submit && replay_ring_enter(ring) ) {
+        fprintf(stderr, "Unable to submit to io_uring: %s\n", strerror(errno));
+        exit(1);
+    }
+    return;
+}
+
+
+/* The ring's fd is readable while there are completions to reap: */
+static void replay_ring_reap(struct ev_loop* loop, ev_io* w, int revents)
+{
+    replay_t* replay = w->data;
+    replay_ring_t* ring = &replay->ring;
+    unsigned head = *ring->cq_head;
+    while( head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) ) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        int32_t res = cqe->res;
+        uint64_t user_data = cqe->user_data;
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        if( user_data == REPLAY_URING_TAG ) {
+            bsat_toq_uring_complete(&replay->toq, res);
+        }
+    }
+    return;
+}
+
+
+static int replay_ring_open(replay_t* replay)
+{
+    replay_ring_t* ring = &replay->ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, 64, &params);
+    if( ring->fd < 0 ) {
+        return -1;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    char* sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ring->fd, IORING_OFF_SQ_RING);
+    char* cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if( sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED ) {
+        return -1;
+    }
+
+    ring->no_entries = params.sq_entries;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->to_submit = 0;
+
+    ev_io_init(&ring->io, replay_ring_reap, ring->fd, EV_READ);
+    ring->io.data = replay;
+    ev_io_start(replay->loop, &ring->io);
+    ev_prepare_init(&ring->submit, replay_ring_submit);
+    ring->submit.data = ring;
+    ev_prepare_start(replay->loop, &ring->submit);
+
+    return bsat_toq_set_uring(&replay->toq,
+            replay_ring_get_sqe, replay_clock, REPLAY_URING_TAG);
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+
+/* Hand the queue's timer over to the backend named on the command line: */
+static int replay_set_backend(replay_t* replay)
+{
+    if( !strcmp(replay->backend, "ev") ) {
+        return 0;
+    }
+
+    if( !strcmp(replay->backend, "scheduler") ) {
+        ev_timer_init(&replay->scheduler, replay_scheduled, 0.0, 0.0);
+        replay->scheduler.data = replay;
+        return bsat_toq_set_scheduler(
+                &replay->toq, replay_schedule, replay_clock);
+    }
+
+    if( !strcmp(replay->backend, "service") ) {
+        if( bsat_service_open(&replay->service) ) {
+            return -1;
+        }
+        return bsat_service_add(&replay->service, &replay->toq);
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if( !strcmp(replay->backend, "uring") ) {
+        return replay_ring_open(replay);
+    }
+#endif /* HAVE_LINUX_IO_URING_H */
+
+    errno = ENOTSUP;
+    return -1;
+}
+
+
+/*--------------------------------------------------
+ * Replay:
+ *--------------------------------------------------*/
+static void replay_expired(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    replay_t* replay = toq->data;
+    replay_item_t* item = timeout->data;
+
+    ev_tstamp late = ev_now(replay->loop) - item->deadline;
+    if( late < 0.0 ) {
+        late = 0.0;
+    }
+
+    /* Report lateness in trace time, not replay time: */
+    late *= replay->speed;
+    replay->no_expired++;
+    replay->no_pending--;
+    replay->lateness_sum += late;
+    if( late > replay->lateness_max ) {
+        replay->lateness_max = late;
+    }
+
+    if( replay->next_event == replay->no_events && !replay->no_pending ) {
+        ev_break(replay->loop, EVBREAK_ALL);
+    }
+    return;
+}
+
+
+static void replay_storm(bsat_toq_t* toq, size_t backlog)
+{
+    replay_t* replay = toq->data;
+    if( backlog ) {
+        replay->no_storms++;
+        if( backlog > replay->max_backlog ) {
+            replay->max_backlog = backlog;
+        }
+    }
+    return;
+}
+
+
+static ev_tstamp replay_event_due(replay_t* replay, size_t idx)
+{
+    return replay->replay_start
+        + (replay->events[idx].tstamp - replay->trace_start) / replay->speed;
+}
+
+
+static void replay_feed(struct ev_loop* loop, ev_timer* w, int revents)
+{
+    replay_t* replay = w->data;
+    ev_tstamp now = ev_now(loop);
+
+    while( replay->next_event < replay->no_events
+            && replay_event_due(replay, replay->next_event) <= now ) {
+        bsat_trace_event_t* event = &replay->events[replay->next_event++];
+        if( event->type > BSAT_TRACE_EXPIRE ) {
+            continue;
+        }
+        replay->no_by_type[event->type]++;
+
+        replay_item_t* item = replay_map_get(
+                &replay->items, event->item,
+                event->type == BSAT_TRACE_START
+                    || event->type == BSAT_TRACE_RESET);
+
+        if( !item ) {
+            if( event->type != BSAT_TRACE_STOP
+                    && event->type != BSAT_TRACE_EXPIRE ) {
+                fprintf(stderr, "Out of memory replaying trace!\n");
+                exit(1);
+            }
+            continue;
+        }
+
+        /* With jitter, items are spread across lanes, so we keep our own
+         * count of what's pending rather than looking at the queue: */
+        int was_active = bsat_timeout_is_active(&item->timeout);
+        switch( event->type ) {
+            case BSAT_TRACE_START:
+                bsat_timeout_start(&replay->toq, &item->timeout);
+                break;
+            case BSAT_TRACE_RESET:
+                bsat_timeout_reset(&replay->toq, &item->timeout);
+                break;
+            case BSAT_TRACE_STOP:
+                bsat_timeout_stop(&replay->toq, &item->timeout);
+                break;
+            default:
+                break;
+        }
+        replay->no_pending += bsat_timeout_is_active(&item->timeout);
+        replay->no_pending -= was_active;
+        item->deadline = bsat_timeout_deadline(&replay->toq, &item->timeout);
+    }
+
+    if( replay->next_event < replay->no_events ) {
+        ev_timer_set(w, replay_event_due(replay, replay->next_event) - now, 0.0);
+        ev_timer_start(loop, w);
+    } else if( !replay->no_pending ) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+    return;
+}
+
+
+static int replay_load(replay_t* replay, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if( fd < 0 ) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if( fstat(fd, &st) || (size_t)st.st_size < sizeof(bsat_trace_header_t) ) {
+        fprintf(stderr, "%s is not a bsat trace file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    bsat_trace_header_t* trace = mmap(
+            NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if( trace == MAP_FAILED ) {
+        fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if( memcmp(trace->magic, BSAT_TRACE_MAGIC, sizeof(trace->magic))
+            || trace->version != BSAT_TRACE_VERSION
+            || (size_t)st.st_size < sizeof(bsat_trace_header_t)
+                + trace->capacity * sizeof(bsat_trace_event_t) ) {
+        fprintf(stderr, "%s is not a valid bsat trace file\n", path);
+        munmap(trace, st.st_size);
+        return -1;
+    }
+
+    /* Unroll the ring buffer, oldest event first: */
+    bsat_trace_event_t* ring = (bsat_trace_event_t*)(trace + 1);
+    uint64_t first = trace->count > trace->capacity ?
+        trace->count - trace->capacity : 0;
+
+    replay->no_events = (size_t)(trace->count - first);
+    replay->events = malloc(
+            (replay->no_events ? replay->no_events : 1)
+            * sizeof(bsat_trace_event_t));
+    if( !replay->events ) {
+        fprintf(stderr, "Out of memory loading trace\n");
+        munmap(trace, st.st_size);
+        return -1;
+    }
+
+    for( size_t i=0; i<replay->no_events; i++ ) {
+        replay->events[i] = ring[(first + i) % trace->capacity];
+    }
+
+    if( replay->after <= 0.0 ) {
+        replay->after = trace->after;
+    }
+
+    if( first ) {
+        fprintf(stderr, "NOTE: trace wrapped; oldest %llu events were lost\n",
+                (unsigned long long)first);
+    }
+
+    munmap(trace, st.st_size);
+    return 0;
+}
+
+
+static void replay_report(replay_t* replay, struct rusage* usage)
+{
+    ev_tstamp span = replay->no_events ?
+        replay->events[replay->no_events-1].tstamp - replay->trace_start : 0.0;
+    double user = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+    double sys = usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+
+    printf("trace:     %zu events over %0.3f s "
+            "(%zu start, %zu reset, %zu stop, %zu expire)\n",
+            replay->no_events, span,
+            replay->no_by_type[BSAT_TRACE_START],
+            replay->no_by_type[BSAT_TRACE_RESET],
+            replay->no_by_type[BSAT_TRACE_STOP],
+            replay->no_by_type[BSAT_TRACE_EXPIRE]);
+    printf("config:    after=%0.3f s, jitter=%0.3f s, slack=%0.3f s, "
+            "speed=%0.2fx, backend=%s\n",
+            replay->after, replay->jitter, replay->slack, replay->speed,
+            replay->backend);
+    printf("replay:    %zu expirations (%zu in trace)\n",
+            replay->no_expired, replay->no_by_type[BSAT_TRACE_EXPIRE]);
+    printf("lateness:  mean %0.3f ms, max %0.3f ms\n",
+            replay->no_expired ?
+                replay->lateness_sum * 1e3 / replay->no_expired : 0.0,
+            replay->lateness_max * 1e3);
+    if( replay->budget ) {
+        printf("storms:    %zu (budget=%zu, factor=%0.1f, max backlog %zu)\n",
+                replay->no_storms, replay->budget, replay->factor,
+                replay->max_backlog);
+    }
+    printf("timer:     %llu arms\n",
+            (unsigned long long)replay->toq.no_timer_arms);
+    printf("cpu:       user %0.3f s, sys %0.3f s (%0.3f us/event)\n",
+            user, sys,
+            replay->no_events ?
+                (user + sys) * 1e6 / replay->no_events : 0.0);
+    return;
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-a AFTER] [-x SPEED] [-b BUDGET [-f FACTOR]] "
+            "[-j JITTER] [-s SLACK] [-B BACKEND] TRACE_FILE\n"
+            "  BACKEND is one of: ev (default), uring, scheduler, service\n",
+            prog);
+    exit(1);
+}
+
+
+/*--------------------------------------------------
+ * Main:
+ *--------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    replay_t replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.speed = 1.0;
+    replay.factor = 8.0;
+    replay.backend = "ev";
+
+    int opt;
+    while( (opt = getopt(argc, argv, "a:x:b:f:j:s:B:")) != -1 ) {
+        switch( opt ) {
+            case 'a':
+                replay.after = strtod(optarg, NULL);
+                break;
+            case 'x':
+                replay.speed = strtod(optarg, NULL);
+                break;
+            case 'b':
+                replay.budget = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                replay.factor = strtod(optarg, NULL);
+                break;
+            case 'j':
+                replay.jitter = strtod(optarg, NULL);
+                break;
+            case 's':
+                replay.slack = strtod(optarg, NULL);
+                break;
+            case 'B':
+                replay.backend = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( optind != argc - 1 || replay.speed <= 0.0 || replay.after < 0.0
+            || replay.slack < 0.0 ) {
+        usage(argv[0]);
+    }
+
+    if( replay_load(&replay, argv[optind]) ) {
+        return 1;
+    }
+
+    if( !replay.no_events ) {
+        fprintf(stderr, "Trace is empty\n");
+        return 1;
+    }
+
+    /* Scale the timeout period along with everything else: */
+    replay.loop = ev_default_loop(0);
+    bsat_toq_init(replay.loop, &replay.toq, replay_expired,
+            replay.after / replay.speed);
+    replay.toq.data = &replay;
+    bsat_toq_set_storm(
+            &replay.toq, replay_storm, replay.factor, replay.budget);
+    if( bsat_toq_set_jitter(&replay.toq, replay.jitter / replay.speed, 8) ) {
+        fprintf(stderr, "Invalid jitter: %s\n", strerror(errno));
+        return 1;
+    }
+    bsat_toq_set_adaptive(&replay.toq, replay.slack / replay.speed);
+    if( replay_set_backend(&replay) ) {
+        fprintf(stderr, "Unable to use the %s backend: %s\n",
+                replay.backend, strerror(errno));
+        return 1;
+    }
+
+    ev_now_update(replay.loop);
+    replay.trace_start = replay.events[0].tstamp;
+    replay.replay_start = ev_now(replay.loop);
+    ev_timer_init(&replay.feed, replay_feed, 0.0, 0.0);
+    replay.feed.data = &replay;
+    ev_timer_start(replay.loop, &replay.feed);
+
+    ev_run(replay.loop, 0);
+    if( replay.toq.service ) {
+        bsat_service_remove(&replay.toq);
+        bsat_service_close(&replay.service);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    replay_report(&replay, &usage);
+    return 0;
+}
@@ -0,0 +1,360 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # bsat-ring-bench
+ *
+ * `bsat-ring-bench` compares the cost of resets and expiry with the
+ * linked-list engine (a `bsat_toq_t`, with its `bsat_timeout_t` embedded in
+ * each connection) and the structure-of-arrays engine (a `bsat_ring_t`).
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C util bsat-ring-bench
+ *
+ * # 1M connections, 4M packets, 30s idle timeout, 1ms ticks:
+ * ./util/bsat-ring-bench -n 1000000 -p 4000000 -a 30 -r 0.001
+ *
+ * # the same, without the vectorized scan:
+ * ./util/bsat-ring-bench -n 1000000 -i scalar
+ * ```
+ *
+ * ## Options
+ *
+ *  - `-n CONNS`: number of connections (default: `1000000`)
+ *  - `-p PACKETS`: total number of packets (default: `4000000`)
+ *  - `-b BATCH`: packets per tick (default: `4000`)
+ *  - `-a AFTER`: idle timeout (default: `30`)
+ *  - `-r RESOLUTION`: tick length, for both engines (default: `0.001`)
+ *  - `-i ISA`: scan kernel for the ring (default: the best available)
+ *
+ * ## Mechanics
+ *
+ * Time is simulated (both engines run in pull mode), so nothing sleeps.
+ * Every connection is started, then each packet resets the timeout of a
+ * (pseudo-)randomly chosen connection, `BATCH` packets per tick. Finally,
+ * the clock jumps past the idle timeout and every connection expires; the
+ * handler touches the connection, as a real one would. The queue uses the
+ * same reset resolution as the ring's tick, so both skip the same resets.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ev.h>
+
+#include "bsat.h"
+
+
+/*----------------------*
+ *        Types:
+ *----------------------*/
+typedef struct bench_config {
+    size_t     no_conns;
+    size_t     no_packets;
+    size_t     batch;
+    ev_tstamp  after;
+    ev_tstamp  resolution;
+    const char* isa;
+} bench_config_t;
+
+typedef struct bench_result {
+    double     reset_elapsed;
+    double     expire_elapsed;
+    size_t     no_expired;
+    size_t     bytes;
+} bench_result_t;
+
+/* Something like a real connection — the timeout is a small part of it: */
+typedef struct bench_conn {
+    bsat_timeout_t timeout;
+    uint64_t no_expired;
+    char state[448];
+} bench_conn_t;
+
+#define BENCH_BASE 1000.0
+#define BENCH_POLL_MAX 256
+
+
+/*----------------------*
+ *      Utilities:
+ *----------------------*/
+static ev_tstamp fake_now = BENCH_BASE;
+
+
+static double bench_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ev_tstamp fake_clock(bsat_toq_t* toq)
+{
+    return fake_now;
+}
+
+
+static uint64_t bench_rand(uint64_t* state)
+{
+    /* xorshift64: cheap enough not to skew the measurement */
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+
+static void toq_expired(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    /* In pull mode, nothing comes through here: */
+    fprintf(stderr, "WARNING: unexpected callback\n");
+}
+
+
+static void ring_expired(bsat_ring_t* ring, uint32_t owner)
+{
+    bench_conn_t* conns = ring->data;
+    conns[owner].no_expired++;
+}
+
+
+/*----------------------*
+ *      Benchmarks:
+ *----------------------*/
+static int bench_toq(
+        struct ev_loop* loop,
+        const bench_config_t* config,
+        bench_result_t* result)
+{
+    bench_conn_t* conns = calloc(config->no_conns, sizeof(bench_conn_t));
+    if( !conns ) {
+        perror("calloc");
+        return -1;
+    }
+
+    bsat_toq_t toq;
+    bsat_toq_init(loop, &toq, toq_expired, config->after);
+    bsat_toq_set_poll_mode(&toq, fake_clock);
+    bsat_toq_set_resolution(&toq, config->resolution);
+
+    fake_now = BENCH_BASE;
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        bsat_timeout_init(&conns[i].timeout);
+        bsat_timeout_start(&toq, &conns[i].timeout);
+    }
+
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    double elapsed = 0.0;
+    size_t remaining = config->no_packets;
+    while( remaining ) {
+        size_t batch = remaining < config->batch ? remaining : config->batch;
+        remaining -= batch;
+        fake_now += config->resolution;
+
+        double started = bench_clock();
+        while( batch-- ) {
+            size_t idx = (size_t)(bench_rand(&rng) % config->no_conns);
+            bsat_timeout_reset(&toq, &conns[idx].timeout);
+        }
+        elapsed += bench_clock() - started;
+    }
+    result->reset_elapsed = elapsed;
+
+    fake_now += config->after + 1.0;
+    size_t no_expired = 0;
+    size_t n;
+    bsat_timeout_t* out[BENCH_POLL_MAX];
+    double started = bench_clock();
+    while( (n = bsat_toq_poll_expired(
+                    &toq, fake_now, out, BENCH_POLL_MAX, NULL)) ) {
+        for( size_t i=0; i<n; i++ ) {
+            bench_conn_t* conn = (bench_conn_t*)(
+                    (char*)out[i] - offsetof(bench_conn_t, timeout));
+            conn->no_expired++;
+        }
+        no_expired += n;
+    }
+    result->expire_elapsed = bench_clock() - started;
+    result->no_expired = no_expired;
+    result->bytes = sizeof(bsat_timeout_t);
+
+    bsat_toq_set_poll_mode(&toq, NULL);
+    bsat_toq_clear(&toq);
+    free(conns);
+    return 0;
+}
+
+
+static int bench_ring(
+        const bench_config_t* config,
+        bench_result_t* result,
+        const char** isa)
+{
+    bench_conn_t* conns = calloc(config->no_conns, sizeof(bench_conn_t));
+    if( !conns ) {
+        perror("calloc");
+        return -1;
+    }
+
+    /* Twice as many slots as owners, so compaction is rare: */
+    bsat_ring_t ring;
+    fake_now = BENCH_BASE;
+    if( bsat_ring_init(&ring, (uint32_t)config->no_conns,
+                (uint32_t)config->no_conns * 2, config->after,
+                config->resolution, fake_now, ring_expired) ) {
+        perror("bsat_ring_init");
+        free(conns);
+        return -1;
+    }
+    if( config->isa && bsat_ring_set_isa(&ring, config->isa) ) {
+        fprintf(stderr, "%s: unsupported\n", config->isa);
+        bsat_ring_free(&ring);
+        free(conns);
+        return -1;
+    }
+    ring.data = conns;
+    *isa = ring.isa;
+
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        bsat_ring_start(&ring, (uint32_t)i, fake_now);
+    }
+
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    double elapsed = 0.0;
+    size_t remaining = config->no_packets;
+    while( remaining ) {
+        size_t batch = remaining < config->batch ? remaining : config->batch;
+        remaining -= batch;
+        fake_now += config->resolution;
+
+        double started = bench_clock();
+        while( batch-- ) {
+            size_t idx = (size_t)(bench_rand(&rng) % config->no_conns);
+            bsat_ring_reset(&ring, (uint32_t)idx, fake_now);
+        }
+        elapsed += bench_clock() - started;
+    }
+    result->reset_elapsed = elapsed;
+
+    fake_now += config->after + 1.0;
+    double started = bench_clock();
+    result->no_expired = bsat_ring_expire(&ring, fake_now, 0);
+    result->expire_elapsed = bench_clock() - started;
+    result->bytes = (size_t)ring.capacity * 2 * sizeof(uint32_t)
+        + (size_t)ring.no_owners * sizeof(uint32_t);
+    result->bytes /= config->no_conns;
+
+    bsat_ring_free(&ring);
+    free(conns);
+    return 0;
+}
+
+
+static void bench_report(
+        const char* label,
+        const bench_config_t* config,
+        const bench_result_t* result)
+{
+    printf("%-14s %4zu B/conn %8.2f ns/reset %8.2f ns/expiry\n",
+            label,
+            result->bytes,
+            result->reset_elapsed * 1e9 / config->no_packets,
+            result->expire_elapsed * 1e9 / result->no_expired);
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n CONNS] [-p PACKETS] [-b BATCH] [-a AFTER]\n"
+            "          [-r RESOLUTION] [-i ISA]\n", prog);
+    exit(1);
+}
+
+
+/*----------------------*
+ *        Main:
+ *----------------------*/
+int main(int argc, char** argv)
+{
+    bench_config_t config = {
+        .no_conns = 1000000,
+        .no_packets = 4000000,
+        .batch = 4000,
+        .after = 30.0,
+        .resolution = 0.001,
+        .isa = NULL,
+    };
+
+    int opt;
+    while( (opt = getopt(argc, argv, "n:p:b:a:r:i:")) != -1 ) {
+        switch( opt ) {
+            case 'n': config.no_conns = strtoul(optarg, NULL, 10); break;
+            case 'p': config.no_packets = strtoul(optarg, NULL, 10); break;
+            case 'b': config.batch = strtoul(optarg, NULL, 10); break;
+            case 'a': config.after = strtod(optarg, NULL); break;
+            case 'r': config.resolution = strtod(optarg, NULL); break;
+            case 'i': config.isa = optarg; break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( !config.no_conns || config.no_conns > UINT32_MAX / 2
+            || !config.no_packets || !config.batch
+            || config.after <= 0.0 || config.resolution <= 0.0 ) {
+        usage(argv[0]);
+    }
+
+    struct ev_loop* loop = ev_default_loop(0);
+    printf("bsat-ring-bench (%s): %zu packets over %zu connections, "
+            "%zu per %gs tick\n",
+            BSAT_VERSION_STR, config.no_packets, config.no_conns,
+            config.batch, config.resolution);
+
+    bench_result_t list;
+    bench_result_t ring;
+    const char* isa = NULL;
+    if( bench_toq(loop, &config, &list)
+            || bench_ring(&config, &ring, &isa) ) {
+        return 1;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "ring (%s)", isa);
+    bench_report("list", &config, &list);
+    bench_report(label, &config, &ring);
+    printf("speedup: %.2fx reset, %.2fx expiry\n",
+            list.reset_elapsed / ring.reset_elapsed,
+            (list.expire_elapsed / list.no_expired)
+            / (ring.expire_elapsed / ring.no_expired));
+    return 0;
+}
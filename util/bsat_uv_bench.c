@@ -0,0 +1,402 @@
+/*============================================================================*
+ * libbsat: timeout management utilities for projects that use libev.
+ * Copyright (c) 2021 Andrew T. Canaday
+ *
+ * This file is part of libbsat, which is licensed under the MIT license.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *----------------------------------------------------------------------------*/
+
+/** # bsat-uv-bench
+ *
+ * `bsat-uv-bench` compares idle timeouts on a libuv loop done two ways: one
+ * `uv_timer_t` per connection, and one `bsat_uv_toq_t` (see `bsat_uv.h`) for
+ * all of them. It requires libuv.
+ *
+ * ```bash
+ * # from your build directory:
+ * make -C util bsat-uv-bench
+ *
+ * # 1M connections, 4M resets, 2s idle timeout:
+ * ./util/bsat-uv-bench -n 1000000 -p 4000000 -a 2
+ * ```
+ *
+ * ## Options
+ *
+ *  - `-n CONNS`: number of connections (default: `100000`)
+ *  - `-p PACKETS`: total number of resets (default: `4000000`)
+ *  - `-b BATCH`: resets per loop iteration (default: `4000`)
+ *  - `-a AFTER`: idle timeout, in seconds (default: `2`)
+ *
+ * ## Mechanics
+ *
+ * Each run starts a timeout for every connection, resets (pseudo-)randomly
+ * chosen ones in batches, running the loop once (without blocking) between
+ * batches, then runs the loop until every connection has timed out. For each
+ * phase, it reports the CPU time used (user + system), along with the memory
+ * used per connection (the RSS growth from allocating and starting the
+ * timeouts).
+ *
+ * NOTE: connections which aren't reset for `AFTER` seconds time out while
+ * the resets are still going on (which is counted as reset time) — if that
+ * leaves none for the last phase, its cost is reported as `0`.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <uv.h>
+
+#include "bsat_uv.h"
+
+
+/*----------------------*
+ *        Types:
+ *----------------------*/
+typedef struct bench_config {
+    size_t     no_conns;
+    size_t     no_packets;
+    size_t     batch;
+    ev_tstamp  after;
+} bench_config_t;
+
+typedef struct bench_result {
+    double     start_cpu;
+    double     reset_cpu;
+    double     expire_cpu;
+    size_t     no_expired;
+    double     rss_per_conn;
+} bench_result_t;
+
+typedef struct bench_ops {
+    size_t     conn_size;
+    int        (*open)(uv_loop_t* loop, const bench_config_t* config);
+    void*      (*conn)(size_t idx);
+    void       (*start)(void* conn);
+    void       (*reset)(void* conn);
+    void       (*close)(void);
+} bench_ops_t;
+
+
+/*----------------------*
+ *       Globals:
+ *----------------------*/
+static char* conns = NULL;
+static size_t no_expired = 0;
+static uint64_t after_ms = 0;
+static bsat_uv_toq_t uvq;
+
+
+/*----------------------*
+ *      Utilities:
+ *----------------------*/
+static double bench_cpu(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+
+static size_t bench_rss(void)
+{
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if( statm ) {
+        if( fscanf(statm, "%*s %ld", &pages) != 1 ) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+
+static uint64_t bench_rand(uint64_t* state)
+{
+    /* xorshift64: cheap enough not to skew the measurement */
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+
+/*----------------------*
+ *  One timer per conn:
+ *----------------------*/
+static void uv_expired(uv_timer_t* timer)
+{
+    no_expired++;
+    return;
+}
+
+
+static int uv_open(uv_loop_t* loop, const bench_config_t* config)
+{
+    uv_timer_t* timers = (uv_timer_t*)conns;
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        int rc = uv_timer_init(loop, &timers[i]);
+        if( rc ) {
+            fprintf(stderr, "uv_timer_init: %s\n", uv_strerror(rc));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void* uv_conn(size_t idx)
+{
+    return &((uv_timer_t*)conns)[idx];
+}
+
+
+static void uv_start(void* conn)
+{
+    uv_timer_start(conn, uv_expired, after_ms, 0);
+    return;
+}
+
+
+static void uv_close_all(void)
+{
+    /* Nothing's active, so there's nothing to do but free the handles
+     * (which libuv does no bookkeeping for once they're stopped): */
+    return;
+}
+
+
+static const bench_ops_t uv_ops = {
+    .conn_size = sizeof(uv_timer_t),
+    .open = uv_open,
+    .conn = uv_conn,
+    .start = uv_start,
+    .reset = uv_start,
+    .close = uv_close_all,
+};
+
+
+/*----------------------*
+ *   One queue for all:
+ *----------------------*/
+static void bsat_expired(bsat_toq_t* toq, bsat_timeout_t* timeout)
+{
+    no_expired++;
+    return;
+}
+
+
+static int bsat_open(uv_loop_t* loop, const bench_config_t* config)
+{
+    if( bsat_uv_toq_init(loop, &uvq, bsat_expired, config->after) ) {
+        perror("bsat_uv_toq_init");
+        return -1;
+    }
+
+    bsat_timeout_t* timeouts = (bsat_timeout_t*)conns;
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        bsat_timeout_init(&timeouts[i]);
+    }
+    return 0;
+}
+
+
+static void* bsat_conn(size_t idx)
+{
+    return &((bsat_timeout_t*)conns)[idx];
+}
+
+
+static void bsat_start(void* conn)
+{
+    bsat_timeout_start(&(uvq.toq), conn);
+    return;
+}
+
+
+static void bsat_reset(void* conn)
+{
+    bsat_timeout_reset(&(uvq.toq), conn);
+    return;
+}
+
+
+static void bsat_close(void)
+{
+    bsat_uv_toq_close(&uvq, NULL);
+    return;
+}
+
+
+static const bench_ops_t bsat_ops = {
+    .conn_size = sizeof(bsat_timeout_t),
+    .open = bsat_open,
+    .conn = bsat_conn,
+    .start = bsat_start,
+    .reset = bsat_reset,
+    .close = bsat_close,
+};
+
+
+/*----------------------*
+ *      Benchmarks:
+ *----------------------*/
+static int bench_run(
+        const bench_ops_t* ops,
+        const bench_config_t* config,
+        bench_result_t* result)
+{
+    uv_loop_t loop;
+    int rc = uv_loop_init(&loop);
+    if( rc ) {
+        fprintf(stderr, "uv_loop_init: %s\n", uv_strerror(rc));
+        return -1;
+    }
+
+    size_t rss_before = bench_rss();
+    conns = calloc(config->no_conns, ops->conn_size);
+    if( !conns ) {
+        perror("calloc");
+        return -1;
+    }
+    if( ops->open(&loop, config) ) {
+        free(conns);
+        return -1;
+    }
+
+    double started = bench_cpu();
+    uv_update_time(&loop);
+    for( size_t i=0; i<config->no_conns; i++ ) {
+        ops->start(ops->conn(i));
+    }
+    result->start_cpu = bench_cpu() - started;
+    result->rss_per_conn = (double)(bench_rss() - rss_before)
+        / config->no_conns;
+
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    size_t remaining = config->no_packets;
+    started = bench_cpu();
+    while( remaining ) {
+        size_t batch = remaining < config->batch ? remaining : config->batch;
+        remaining -= batch;
+        while( batch-- ) {
+            size_t idx = (size_t)(bench_rand(&rng) % config->no_conns);
+            ops->reset(ops->conn(idx));
+        }
+        uv_run(&loop, UV_RUN_NOWAIT);
+    }
+    result->reset_cpu = bench_cpu() - started;
+
+    /* Everything still pending goes idle, and times out: */
+    result->no_expired = config->no_conns - no_expired;
+    started = bench_cpu();
+    while( no_expired < config->no_conns ) {
+        uv_run(&loop, UV_RUN_ONCE);
+    }
+    result->expire_cpu = bench_cpu() - started;
+
+    ops->close();
+    uv_run(&loop, UV_RUN_DEFAULT);
+    free(conns);
+    conns = NULL;
+    no_expired = 0;
+    return 0;
+}
+
+
+static void bench_report(
+        const char* label,
+        const bench_config_t* config,
+        const bench_result_t* result)
+{
+    printf("%-18s %7.1f B/conn %8.2f ns/start %8.2f ns/reset "
+            "%8.2f ns/expiry\n",
+            label,
+            result->rss_per_conn,
+            result->start_cpu * 1e9 / config->no_conns,
+            result->reset_cpu * 1e9 / config->no_packets,
+            result->no_expired
+                ? result->expire_cpu * 1e9 / result->no_expired : 0.0);
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n CONNS] [-p PACKETS] [-b BATCH] [-a AFTER]\n", prog);
+    exit(1);
+}
+
+
+/*----------------------*
+ *        Main:
+ *----------------------*/
+int main(int argc, char** argv)
+{
+    bench_config_t config = {
+        .no_conns = 100000,
+        .no_packets = 4000000,
+        .batch = 4000,
+        .after = 2.0,
+    };
+
+    int opt;
+    while( (opt = getopt(argc, argv, "n:p:b:a:")) != -1 ) {
+        switch( opt ) {
+            case 'n': config.no_conns = strtoul(optarg, NULL, 10); break;
+            case 'p': config.no_packets = strtoul(optarg, NULL, 10); break;
+            case 'b': config.batch = strtoul(optarg, NULL, 10); break;
+            case 'a': config.after = strtod(optarg, NULL); break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if( !config.no_conns || !config.no_packets || !config.batch
+            || config.after < 0.001 ) {
+        usage(argv[0]);
+    }
+    after_ms = (uint64_t)(config.after * 1e3);
+
+    printf("bsat-uv-bench (%s, libuv %s): %zu connections, "
+            "%zu resets, %gs idle timeout\n",
+            BSAT_VERSION_STR, uv_version_string(), config.no_conns,
+            config.no_packets, config.after);
+
+    bench_result_t timers;
+    bench_result_t queue;
+    if( bench_run(&uv_ops, &config, &timers)
+            || bench_run(&bsat_ops, &config, &queue) ) {
+        return 1;
+    }
+
+    bench_report("uv_timer_t/conn", &config, &timers);
+    bench_report("bsat_uv_toq_t", &config, &queue);
+    printf("memory: %.2fx  cpu: %.2fx\n",
+            timers.rss_per_conn / queue.rss_per_conn,
+            (timers.start_cpu + timers.reset_cpu + timers.expire_cpu)
+            / (queue.start_cpu + queue.reset_cpu + queue.expire_cpu));
+    return 0;
+}